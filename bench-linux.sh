@@ -0,0 +1,63 @@
+#!/bin/bash
+# Нагрузочный тест конвейера fit -> vocab -> train -> selftest на синтетическом корпусе.
+# Для каждого масштаба (в токенах) выводится время работы, пиковое потребление памяти каждой стадии
+# и скорость обучения (слов в секунду). Для стадии vocab выводится также сводка сопоставления шаблонов словосочетаний
+# (MWE_LIST задаёт список шаблонов, например, с иной долей узлов, сопоставляемых по токену).
+# Пример: SCALES="1000000 10000000" THREADS=16 ./bench-linux.sh
+
+SCALES=${SCALES:-"1000000"}
+LEMMAS=${LEMMAS:-50000}
+ZIPF=${ZIPF:-1.0}
+MWE_RATE=${MWE_RATE:-0.3}
+SEED=${SEED:-1}
+SIZE_DEP=${SIZE_DEP:-75}
+SIZE_ASSOC=${SIZE_ASSOC:-25}
+ITER=${ITER:-5}
+THREADS=${THREADS:-8}
+TRAIN_OPTS=${TRAIN_OPTS:-""}
+BENCH_DIR=${BENCH_DIR:-bench}
+MWE_LIST=${MWE_LIST:-./data/mwe.list}
+
+echo "MAKING BINARIES"
+make || exit 1
+mkdir -p $BENCH_DIR
+cp ./data/stopwords.assoc ./data/stopwords.common_nouns $BENCH_DIR/
+cp $MWE_LIST $BENCH_DIR/mwe.list
+ln -sfn ../russe2015data $BENCH_DIR/russe2015data
+ln -sfn ../rusim1000data $BENCH_DIR/rusim1000data
+cd $BENCH_DIR
+
+# запуск стадии с протоколированием; из протокола извлекаются время работы и пиковая память
+STAGE_SECONDS=0
+run_stage()
+{
+  local name=$1; shift
+  ../mwe2vec "$@" > $name.log 2>&1 < /dev/null
+  local status=$?
+  STAGE_SECONDS=$(grep "time elapsed" $name.log | tail -1 | awk '{print $3}')
+  local rss=$(grep "peak RSS" $name.log | tail -1 | awk '{print $3}')
+  printf "  %-10s %12s s %10s MB\n" $name ${STAGE_SECONDS:-n/a} ${rss:-n/a}
+  if [ $status -ne 0 ]; then
+    echo "  stage '$name' failed, see $BENCH_DIR/$name.log"
+    exit 1
+  fi
+}
+
+for SCALE in $SCALES; do
+  echo ""
+  echo "SCALE: $SCALE tokens"
+  run_stage gen      -task gen -fit_input raw_$SCALE.conll -gen_tokens $SCALE -gen_lemmas $LEMMAS -gen_zipf $ZIPF -gen_mwe $MWE_RATE -gen_seed $SEED
+  run_stage fit      -task fit -fit_input raw_$SCALE.conll -train train_$SCALE.conll
+  run_stage vocab    -task vocab -train train_$SCALE.conll \
+                     -vocab_m main.vocab -vocab_p proper.vocab -vocab_t tokens.vocab -vocab_d ctx_dep.vocab \
+                     -min-count_m 5 -min-count_p 5 -min-count_t 5 -min-count_d 5
+  grep -E "^  (patterns|candidate checks):" vocab.log | tail -2
+  run_stage train    -task train -train train_$SCALE.conll \
+                     -vocab_m main.vocab -backup backup.data -vocab_d ctx_dep.vocab -vocab_a main.vocab -model vectors.bin \
+                     -size_d $SIZE_DEP -size_a $SIZE_ASSOC -negative 4 -iter $ITER -threads $THREADS $TRAIN_OPTS
+  TRAIN_SECONDS=$STAGE_SECONDS
+  run_stage selftest -task selftest_ru -model vectors.bin -size_d $SIZE_DEP -size_a $SIZE_ASSOC
+  TOKENS=$(grep "Tokens count" vocab.log | tail -1 | awk '{print $3}')
+  awk -v t=$TOKENS -v i=$ITER -v s=$TRAIN_SECONDS 'BEGIN { if (s > 0) printf "  train speed: %.2fk words/sec\n", t * i / s / 1000 }'
+  rm -f raw_$SCALE.conll train_$SCALE.conll
+done
@@ -0,0 +1,105 @@
+#ifndef ATOM_TABLE_H_
+#define ATOM_TABLE_H_
+
+#include <string>
+#include <string_view>
+#include <deque>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <cstdint>
+
+
+// Глобальная таблица интернирования строк (атомов).
+// Каждой строке (лемме, токену, типу связи) сопоставляется плотный целочисленный идентификатор,
+// после чего словари и справочники ищут данные по атому индексированием массива, а не хэшированием строки.
+// Таблица только пополняется. Пополнение потокобезопасно; после заморозки (freeze) таблица неизменна и поиск выполняется без блокировок.
+class AtomTable
+{
+public:
+  static constexpr uint32_t INVALID_ATOM = std::numeric_limits<uint32_t>::max();
+  // единственный экземпляр таблицы
+  static AtomTable& global()
+  {
+    static AtomTable instance;
+    return instance;
+  } // method-end
+  // получение атома для строки (с добавлением строки в таблицу при необходимости)
+  // после заморозки новые строки не добавляются (возвращается INVALID_ATOM)
+  uint32_t intern(std::string_view str)
+  {
+    if ( frozen )
+      return find(str);
+    {
+      std::shared_lock<std::shared_mutex> lock(mtx);
+      auto it = index.find(str);
+      if ( it != index.end() )
+        return it->second;
+    }
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    auto it = index.find(str);
+    if ( it != index.end() )
+      return it->second;
+    uint32_t atom = strings.size();
+    strings.emplace_back(str);
+    index.emplace(strings.back(), atom);  // ключ ссылается на строку в deque (адреса элементов deque стабильны при добавлении в конец)
+    atoms_count = strings.size();
+    return atom;
+  } // method-end
+  // поиск атома без пополнения таблицы (INVALID_ATOM, если строка неизвестна)
+  uint32_t find(std::string_view str) const
+  {
+    if ( frozen )
+      return lookup(str);
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    return lookup(str);
+  } // method-end
+  // получение строки по атому
+  const std::string& str(uint32_t atom) const
+  {
+    if ( frozen )
+      return strings[atom];
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    return strings[atom];
+  } // method-end
+  // количество атомов в таблице
+  size_t size() const
+  {
+    return atoms_count;
+  } // method-end
+  // заморозка таблицы (выполняется, когда все справочники построены, перед многопоточной обработкой)
+  void freeze()
+  {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    frozen = true;
+  } // method-end
+  bool is_frozen() const
+  {
+    return frozen;
+  } // method-end
+private:
+  AtomTable()
+  {
+  }
+  AtomTable(const AtomTable&) = delete;
+  AtomTable& operator=(const AtomTable&) = delete;
+
+  mutable std::shared_mutex mtx;
+  std::atomic<bool> frozen{false};
+  std::atomic<size_t> atoms_count{0};
+  // хранилище строк (индекс в deque -- атом)
+  std::deque<std::string> strings;
+  // отображение строк в атомы
+  std::unordered_map<std::string_view, uint32_t> index;
+
+  inline uint32_t lookup(std::string_view str) const
+  {
+    auto it = index.find(str);
+    return (it == index.end()) ? INVALID_ATOM : it->second;
+  } // method-end
+}; // class-decl-end
+
+
+#endif /* ATOM_TABLE_H_ */
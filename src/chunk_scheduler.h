@@ -0,0 +1,94 @@
+#ifndef CHUNK_SCHEDULER_H_
+#define CHUNK_SCHEDULER_H_
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+
+// Планировщик порций обучающего множества с перехватом работы (work stealing).
+// В начале эпохи каждому потоку закрепляется непрерывный диапазон порций (как при статическом разбиении, что сохраняет
+// последовательное чтение файла). Поток выбирает порции из начала своего диапазона, а исчерпав его, забирает порции
+// с конца диапазона наиболее загруженного потока. Диапазон хранится в одном атомарном слове (эпоха, начало, конец)
+// и изменяется только через CAS, без блокировок.
+class ChunkScheduler
+{
+public:
+  // инициализация (вызывается однократно до запуска потоков)
+  void reset(size_t chunksCount, size_t threadsCount)
+  {
+    chunks_count = chunksCount;
+    slots = std::vector<Slot>(threadsCount);
+  } // method-end
+  // подготовка эпохи потоком управления: диапазоны, ещё не назначенные на эту эпоху, заполняются начальными значениями
+  // (диапазоны предыдущей эпохи к этому моменту гарантированно исчерпаны, иначе поток не завершил бы её)
+  void prepare(size_t epoch)
+  {
+    uint64_t tag = epoch + 1;
+    for (size_t t = 0; t < slots.size(); ++t)
+    {
+      uint64_t cur = slots[t].range.load();
+      while ( tag_of(cur) < tag )
+        if ( slots[t].range.compare_exchange_weak(cur, pack(tag, chunks_count * t / slots.size(), chunks_count * (t + 1) / slots.size())) )
+          break;
+    }
+  } // method-end
+  // получение очередной порции эпохи (false -- порции эпохи закончились у всех потоков)
+  bool next(size_t threadIndex, size_t epoch, size_t& chunk)
+  {
+    uint64_t tag = epoch + 1;
+    // сначала -- из начала собственного диапазона
+    auto& own = slots[threadIndex].range;
+    uint64_t cur = own.load();
+    while ( tag_of(cur) == tag && begin_of(cur) < end_of(cur) )
+      if ( own.compare_exchange_weak(cur, pack(tag, begin_of(cur) + 1, end_of(cur))) )
+      {
+        chunk = begin_of(cur);
+        return true;
+      }
+    // затем -- с конца диапазона потока, у которого осталось больше всего порций
+    while (true)
+    {
+      size_t victim = slots.size();
+      uint64_t victim_range = 0;
+      size_t best = 0;
+      for (size_t t = 0; t < slots.size(); ++t)
+      {
+        uint64_t r = slots[t].range.load();
+        if ( tag_of(r) == tag && end_of(r) - begin_of(r) > best && begin_of(r) < end_of(r) )
+        {
+          best = end_of(r) - begin_of(r);
+          victim = t;
+          victim_range = r;
+        }
+      }
+      if ( victim == slots.size() )
+        return false;
+      if ( slots[victim].range.compare_exchange_strong(victim_range, pack(tag, begin_of(victim_range), end_of(victim_range) - 1)) )
+      {
+        chunk = end_of(victim_range) - 1;
+        return true;
+      }
+    }
+  } // method-end
+private:
+  // диапазон порций потока: 16 бит -- номер эпохи + 1 (0 -- не назначен), по 24 бита -- начало и конец диапазона
+  struct alignas(64) Slot
+  {
+    std::atomic<uint64_t> range{0};
+  };
+  std::vector<Slot> slots;
+  size_t chunks_count = 0;
+
+  static inline uint64_t pack(uint64_t tag, uint64_t begin, uint64_t end)
+  {
+    return (tag << 48) | (begin << 24) | end;
+  } // method-end
+  static inline uint64_t tag_of(uint64_t r) { return r >> 48; }
+  static inline uint64_t begin_of(uint64_t r) { return (r >> 24) & 0xFFFFFF; }
+  static inline uint64_t end_of(uint64_t r) { return r & 0xFFFFFF; }
+}; // class-decl-end
+
+
+#endif /* CHUNK_SCHEDULER_H_ */
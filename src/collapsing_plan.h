@@ -0,0 +1,55 @@
+#ifndef COLLAPSING_PLAN_H_
+#define COLLAPSING_PLAN_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+// План усреднения векторов (схлопывания временных словосочетаний в вершину) в формате CSR:
+// для группы g целевой вектор targets[g] заменяется взвешенной суммой векторов sources[offsets[g] .. offsets[g+1])
+// с весами weights[offsets[g] .. offsets[g+1]).
+// План строится однократно (с разрешением индексов в словаре), после чего применяется без обращений к словарю.
+class CollapsingPlan
+{
+public:
+  CollapsingPlan()
+  : offsets(1, 0)
+  {
+  }
+  void clear()
+  {
+    targets.clear();
+    offsets.assign(1, 0);
+    sources.clear();
+    weights.clear();
+  } // method-end
+  // открытие новой группы с заданным целевым вектором
+  void begin_group(size_t target)
+  {
+    targets.push_back(target);
+    offsets.push_back(sources.size());
+  } // method-end
+  // добавление слагаемого в последнюю открытую группу
+  void add_source(size_t source, float weight)
+  {
+    sources.push_back(source);
+    weights.push_back(weight);
+    ++offsets.back();
+  } // method-end
+  size_t groups_count() const { return targets.size(); }
+  bool empty() const { return targets.empty(); }
+  size_t target(size_t group) const { return targets[group]; }
+  size_t group_begin(size_t group) const { return offsets[group]; }
+  size_t group_end(size_t group) const { return offsets[group + 1]; }
+  size_t source(size_t pos) const { return sources[pos]; }
+  float weight(size_t pos) const { return weights[pos]; }
+private:
+  std::vector<size_t> targets;
+  std::vector<size_t> offsets;
+  std::vector<size_t> sources;
+  std::vector<float> weights;
+}; // class-decl-end
+
+
+#endif /* COLLAPSING_PLAN_H_ */
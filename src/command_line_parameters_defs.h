@@ -23,6 +23,9 @@ public:
         {"-vocab_a",      {"Associative contexts vocabulary <file>", std::nullopt, std::nullopt}},
         {"-backup",       {"Save neural network weights to <file>", std::nullopt, std::nullopt}},
         {"-restore",      {"Restore neural network weights from <file>", std::nullopt, std::nullopt}},
+        {"-incremental",  {"Continue training of -restore backup on new data (vocabs are extended by -delta_m/-delta_d)", "0", std::nullopt}},
+        {"-delta_m",      {"Lemmas main vocabulary <file> of new training data", std::nullopt, std::nullopt}},
+        {"-delta_d",      {"Dependency contexts vocabulary <file> of new training data", std::nullopt, std::nullopt}},
         {"-min-count_m",  {"Min frequency in Lemmas main vocabulary", "50", std::nullopt}},
         {"-min-count_p",  {"Min frequency in Lemmas proper-names vocabulary", "50", std::nullopt}},
         {"-min-count_t",  {"Min frequency in Tokens vocabulary", "50", std::nullopt}},
@@ -38,13 +41,25 @@ public:
         {"-sample_d",     {"Dependency contexts subsampling threshold", "1e-4", std::nullopt}},
         {"-sample_a",     {"Associative contexts subsampling threshold", "1e-5", std::nullopt}},
         {"-threads",      {"Use <int> threads", "8", std::nullopt}},
+        {"-deterministic",{"Reproducible training (single-threaded, over -threads fixed shards)", "0", std::nullopt}},
+        {"-shuffle",      {"Per-thread sentence shuffle buffer size (0 -- file order)", "0", std::nullopt}},
+        {"-stream",       {"Continuous training over all epochs with dynamic chunk distribution", "0", std::nullopt}},
+        {"-assoc_window", {"Associative contexts window half-width (0 -- whole sentence)", "0", std::nullopt}},
+        {"-assoc_max",    {"Max associative contexts per word (0 -- unlimited)", "0", std::nullopt}},
+        {"-collapse_log", {"Print weights of transient MWE collapsing (train)", "0", std::nullopt}},
+        {"-mwe_cache",    {"Keep MWE substitutions of -train in a sidecar file and reuse them (vocab, train)", "0", std::nullopt}},
         {"-fit_input",    {"<file>.conll to fit (or stdin)", std::nullopt, std::nullopt}},
         {"-a_ratio" ,     {"Associations contribution to similarity", "1.0", std::nullopt}},
         {"-st_yo" ,       {"Replace 'yo' in russe while self-testing", "0", std::nullopt}},
         {"-sub_l" ,       {"Left range bound for sub-model", std::nullopt, std::nullopt}},
         {"-sub_r" ,       {"Right range bound for sub-model", std::nullopt, std::nullopt}},
         {"-fsim_file" ,   {"File with word pairs for fsim task", std::nullopt, std::nullopt}},
-        {"-fsim_fmt" ,    {"File with word pairs format (detail|russe)", "detail", std::nullopt}}
+        {"-fsim_fmt" ,    {"File with word pairs format (detail|russe)", "detail", std::nullopt}},
+        {"-gen_tokens",   {"Synthetic corpus size (in tokens)", "1000000", std::nullopt}},
+        {"-gen_lemmas",   {"Synthetic lexicon size", "50000", std::nullopt}},
+        {"-gen_zipf",     {"Zipf exponent for synthetic lexicon", "1.0", std::nullopt}},
+        {"-gen_mwe",      {"Share of synthetic sentences containing MWE", "0.3", std::nullopt}},
+        {"-gen_seed",     {"Synthetic corpus generator seed", "1", std::nullopt}}
     };
   }
 };
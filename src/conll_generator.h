@@ -0,0 +1,304 @@
+#ifndef CONLL_GENERATOR_H_
+#define CONLL_GENERATOR_H_
+
+#include "mwe_vocabulary.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+
+// Генератор синтетического conll-корпуса (для нагрузочного тестирования конвейера fit -> vocab -> train -> selftest).
+// Леммы распределены по закону Ципфа, предложения имеют правдоподобную древесную структуру,
+// в часть предложений встраиваются словосочетания из mwe.list.
+// Результат полностью определяется параметрами генерации (включая seed).
+class ConllGenerator
+{
+private:
+  // части речи синтетического лексикона
+  enum PartOfSpeech
+  {
+    posNoun,
+    posProper,
+    posVerb,
+    posAdj,
+    posAdv,
+    posCount
+  };
+  // узел порождаемого дерева
+  struct GenNode
+  {
+    std::string lemma;
+    std::string token;
+    std::string pos;    // частеречная метка (колонки 3 и 4)
+    std::string feats;  // морфологическая метка (колонка 5)
+    int head;           // индекс родителя в массиве узлов (-1 -- корень)
+    std::string rel;    // тип синтаксической связи
+    bool left;          // располагать ли узел левее родителя
+  };
+  // распределение Ципфа (табличное)
+  class ZipfSampler
+  {
+  public:
+    void init(size_t n, double s)
+    {
+      cdf.resize(n);
+      double sum = 0;
+      for (size_t r = 0; r < n; ++r)
+      {
+        sum += 1.0 / std::pow(r + 1, s);
+        cdf[r] = sum;
+      }
+      for (auto& v : cdf)
+        v /= sum;
+    }
+    size_t sample(double u) const
+    {
+      return std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    }
+  private:
+    std::vector<double> cdf;
+  };
+public:
+  ConllGenerator(uint64_t tokensCount, size_t lemmasCount, double zipfExponent, double mweRate, uint64_t seed)
+  : tokens_count(tokensCount)
+  , lemmas_count(lemmasCount < 100 ? 100 : lemmasCount)
+  , zipf_exponent(zipfExponent)
+  , mwe_rate(mweRate)
+  , state(seed)
+  {
+  }
+  // функция порождения корпуса
+  bool run(const std::string& mwe_fn, const std::string& output_fn)
+  {
+    // загружаем словосочетания (без фильтрации по словарю)
+    MweVocabulary v_mwe;
+    if ( !v_mwe.load(mwe_fn, nullptr, true) )
+      return false;
+    for (auto& p : v_mwe.get_phrases())
+      phrases.push_back(p.second);
+    // открываем файл для сохранения результатов
+    std::ofstream ofs( output_fn.c_str(), std::ios::binary );
+    if ( !ofs.good() )
+    {
+      std::cerr << "Generated-file open: error" << std::endl;
+      return false;
+    }
+    build_lexicon();
+    // порождаем предложения, пока не наберём требуемый объём корпуса
+    uint64_t tokens_written = 0, sentences_written = 0, mwe_inserted = 0;
+    std::vector<GenNode> nodes;
+    while (tokens_written < tokens_count)
+    {
+      nodes.clear();
+      if ( make_sentence(nodes) )
+        ++mwe_inserted;
+      tokens_written += save_sentence(ofs, nodes);
+      ++sentences_written;
+    }
+    std::cout << "Sentences generated: " << sentences_written << std::endl;
+    std::cout << "Tokens generated: " << tokens_written << std::endl;
+    std::cout << "MWE occurrences: " << mwe_inserted << std::endl;
+    return true;
+  } // method-end
+private:
+  // требуемый объём корпуса (в токенах)
+  uint64_t tokens_count;
+  // объём синтетического лексикона
+  size_t lemmas_count;
+  // показатель степени в законе Ципфа
+  double zipf_exponent;
+  // вероятность встраивания словосочетания в предложение
+  double mwe_rate;
+  // состояние генератора случайных чисел (splitmix64; не зависит от реализации стандартной библиотеки)
+  uint64_t state;
+  // лексикон: леммы, сгруппированные по частям речи (порядок соответствует рангу)
+  std::vector<std::string> lexicon[posCount];
+  ZipfSampler zipf[posCount];
+  // словосочетания из mwe.list
+  std::vector< std::shared_ptr<Phrase> > phrases;
+
+  uint64_t next_random()
+  {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+  double next_uniform()
+  {
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+  }
+  size_t next_below(size_t n)
+  {
+    return next_random() % n;
+  }
+  // построение синтетического лексикона из "псевдорусских" слогов
+  void build_lexicon()
+  {
+    const std::vector<std::string> SYLLABLES = { "ба", "ве", "го", "ди", "жу", "за", "ки", "ло", "ме", "ну",
+                                                 "пи", "ро", "су", "те", "фа", "хи", "це", "чу", "ша", "мо" };
+    const std::vector<std::string> SUFFIXES = { "", "ин", "ть", "ый", "о" };
+    const size_t shares[posCount] = { 50, 5, 20, 20, 5 };  // доли частей речи (в процентах)
+    for (size_t p = 0; p < posCount; ++p)
+    {
+      size_t n = lemmas_count * shares[p] / 100;
+      lexicon[p].reserve(n);
+      for (size_t i = 0; i < n; ++i)
+      {
+        std::string lemma;
+        size_t code = i * posCount + p + SYLLABLES.size();  // не менее двух слогов; коды частей речи не пересекаются
+        while (code > 0)
+        {
+          lemma += SYLLABLES[code % SYLLABLES.size()];
+          code /= SYLLABLES.size();
+        }
+        lexicon[p].push_back(lemma + SUFFIXES[p]);
+      }
+      zipf[p].init(n, zipf_exponent);
+    }
+  } // method-end
+  // добавление узла лексикона в дерево
+  int add_word(std::vector<GenNode>& nodes, PartOfSpeech pos, int head, const std::string& rel, bool left)
+  {
+    const char* POS_TAGS[posCount]  = { "S", "S", "V", "A", "ADV" };
+    const char* FEATS[posCount]     = { "Ncmsnn", "Npmsny", "Vmip3s-a-e", "Afpmsnf", "R" };
+    const std::vector<std::string> ENDINGS = { "", "", "", "а", "у", "ом" };
+    auto& lemma = lexicon[pos][ zipf[pos].sample(next_uniform()) ];
+    std::string token = lemma;
+    if (pos == posNoun)
+      token += ENDINGS[next_below(ENDINGS.size())];
+    nodes.push_back( {lemma, token, POS_TAGS[pos], FEATS[pos], head, rel, left} );
+    return nodes.size() - 1;
+  } // method-end
+  int add_prep(std::vector<GenNode>& nodes, int head, const std::string& rel)
+  {
+    const std::vector<std::string> PREPS = { "в", "на", "с", "к", "по", "из", "за", "о" };
+    auto& prep = PREPS[next_below(PREPS.size())];
+    nodes.push_back( {prep, prep, "PR", "Sp-a", head, rel, false} );
+    int prep_idx = nodes.size() - 1;
+    add_word(nodes, posNoun, prep_idx, "предл", false);
+    return prep_idx;
+  } // method-end
+  // порождение узлов, соответствующих шаблону словосочетания; возвращает индекс верхнего узла
+  int add_pattern(std::vector<GenNode>& nodes, std::shared_ptr<TreeNode> pattern, int child_idx)
+  {
+    nodes.push_back( {pattern->word, pattern->word, "S", "Ncmsnn", -1, "1-компл", false} );
+    int idx = nodes.size() - 1;
+    if (child_idx != -1)
+      nodes[child_idx].head = idx;
+    for (auto& ch : pattern->children)
+      add_pattern_subtree(nodes, ch, idx);
+    if (pattern->head)
+      return add_pattern(nodes, pattern->head, idx);
+    return idx;
+  } // method-end
+  void add_pattern_subtree(std::vector<GenNode>& nodes, std::shared_ptr<TreeNode> pattern, int head_idx)
+  {
+    // зависимые шаблона располагаем в соответствии с их обычной позицией (листовые определения -- слева)
+    nodes.push_back( {pattern->word, pattern->word, "S", "Ncmsnn", head_idx, "опред", pattern->children.empty()} );
+    int idx = nodes.size() - 1;
+    for (auto& ch : pattern->children)
+      add_pattern_subtree(nodes, ch, idx);
+  } // method-end
+  // порождение случайного словосочетания, присоединённого к корневому глаголу
+  void add_phrase(std::vector<GenNode>& nodes)
+  {
+    auto& phrase = phrases[ next_below(phrases.size()) ];
+    auto& tree = phrase->trees[ next_below(phrase->trees.size()) ];
+    int top = add_pattern(nodes, tree, -1);
+    nodes[top].head = 0;
+  } // method-end
+  // порождение дерева предложения; возвращает true, если в предложение встроено словосочетание
+  bool make_sentence(std::vector<GenNode>& nodes)
+  {
+    size_t target_len = 3 + next_below(20);
+    add_word(nodes, posVerb, -1, "ROOT", false);
+    bool has_subject = false;
+    bool need_mwe = !phrases.empty() && next_uniform() < mwe_rate;
+    bool with_mwe = false;
+    // словосочетание встраивается, как только в предложении набирается mwe_slot узлов
+    // (шаг порождения может добавить несколько узлов, поэтому позиция задаётся числом узлов, а не номером шага)
+    size_t mwe_slot = need_mwe ? 1 + next_below(target_len - 1) : target_len;
+    while ( nodes.size() < target_len )
+    {
+      if (need_mwe && !with_mwe && nodes.size() >= mwe_slot)
+      {
+        add_phrase(nodes);
+        with_mwe = true;
+        continue;
+      }
+      int parent = next_below(nodes.size());
+      auto& parent_pos = nodes[parent].pos;
+      double u = next_uniform();
+      if (parent_pos == "V")
+      {
+        if (!has_subject)                  { add_word(nodes, next_uniform() < 0.1 ? posProper : posNoun, parent, "предик", true); has_subject = true; }
+        else if (u < 0.45)                 add_word(nodes, posNoun, parent, "1-компл", false);
+        else if (u < 0.65)                 add_word(nodes, posNoun, parent, "2-компл", false);
+        else if (u < 0.80)                 add_word(nodes, posAdv, parent, "обст", true);
+        else                               add_prep(nodes, parent, "обст");
+      }
+      else if (parent_pos == "S" && nodes[parent].rel != "ROOT")
+      {
+        if (u < 0.6)                       add_word(nodes, posAdj, parent, "опред", true);
+        else if (u < 0.85)                 add_word(nodes, posNoun, parent, "атриб", false);
+        else                               add_prep(nodes, parent, "атриб");
+      }
+      else
+        add_word(nodes, posAdv, 0, "обст", true);
+    }
+    // последний шаг мог перескочить позицию словосочетания -- тогда оно дописывается в конец (частота встраивания равна -gen_mwe)
+    if (need_mwe && !with_mwe)
+    {
+      add_phrase(nodes);
+      with_mwe = true;
+    }
+    return with_mwe;
+  } // method-end
+  // линеаризация дерева (проективный порядок) и сохранение предложения; возвращает количество токенов
+  size_t save_sentence(std::ofstream& ofs, const std::vector<GenNode>& nodes)
+  {
+    std::vector< std::vector<int> > children( nodes.size() );
+    int root = 0;
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+      if (nodes[i].head < 0)
+        root = i;
+      else
+        children[ nodes[i].head ].push_back(i);
+    }
+    std::vector<int> order;
+    order.reserve(nodes.size());
+    linearize(nodes, children, root, order);
+    std::vector<int> position( nodes.size() );
+    for (size_t i = 0; i < order.size(); ++i)
+      position[ order[i] ] = i + 1;
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+      auto& n = nodes[ order[i] ];
+      int head_no = (n.head < 0) ? 0 : position[n.head];
+      ofs << (i+1) << '\t' << n.token << '\t' << n.lemma << '\t' << n.pos << '\t' << n.pos << '\t'
+          << n.feats << '\t' << head_no << '\t' << n.rel << "\t_\t_\n";
+    }
+    ofs << (order.size()+1) << "\t.\t.\tSENT\tSENT\tSENT\t" << position[root] << "\tPUNC\t_\t_\n";
+    ofs << '\n';
+    return order.size() + 1;
+  } // method-end
+  void linearize(const std::vector<GenNode>& nodes, const std::vector< std::vector<int> >& children, int idx, std::vector<int>& order)
+  {
+    for (auto ch : children[idx])
+      if (nodes[ch].left)
+        linearize(nodes, children, ch, order);
+    order.push_back(idx);
+    for (auto ch : children[idx])
+      if (!nodes[ch].left)
+        linearize(nodes, children, ch, order);
+  } // method-end
+}; // class-decl-end
+
+
+#endif /* CONLL_GENERATOR_H_ */
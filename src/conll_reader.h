@@ -1,6 +1,8 @@
 #ifndef CONLL_READER_H_
 #define CONLL_READER_H_
 
+#include "conll_sentence.h"
+
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -29,9 +31,25 @@ public:
   static bool read_sentence(FILE *f, std::vector< std::vector<std::string> >& result)
   {
     result.clear();
+    return read_rows(f, [&result](size_t fieldsCount) -> std::vector<std::string>& { result.emplace_back(fieldsCount); return result.back(); });
+  } // method-end
+  // чтение предложения с разбором числовых колонок и вычислением атомов строковых колонок
+  // (строки токенов предыдущего предложения переиспользуются)
+  static bool read_sentence(FILE *f, ConllSentence& result)
+  {
+    result.clear();
+    bool status = read_rows(f, [&result](size_t fieldsCount) -> ConllSentence::Token& { return result.append_row(fieldsCount); });
+    result.parse_numeric();
+    result.resolve_atoms();
+    return status;
+  } // method-end
+private:
+  // чтение строк предложения; appendRow(n) предоставляет место для очередного токена из n полей
+  template<typename AppendRowFunc>
+  static bool read_rows(FILE *f, AppendRowFunc appendRow)
+  {
     bool status = true;
-    std::string line;
-    line.reserve(1024);
+    thread_local std::string line;  // буфер строки потока управления (память переиспользуется от предложения к предложению)
     while (true)
     {
       read_line(f, line);
@@ -47,8 +65,7 @@ public:
       size_t delimiters_count = std::count(line.begin(), line.end(), '\t');
       if ( delimiters_count != 9 ) // должно быть 10 полей, т.е. 9 разделителей
         status = false;
-      result.emplace_back(delimiters_count+1);
-      auto& last_token = result.back();
+      auto& last_token = appendRow(delimiters_count+1);
       size_t fieldStartPos = 0;
       size_t idx = 0;
       while (true)
@@ -56,12 +73,12 @@ public:
         size_t fieldEndPos = line.find('\t', fieldStartPos);
         if ( fieldEndPos != std::string::npos )
         {
-          last_token[idx++] = line.substr(fieldStartPos, fieldEndPos-fieldStartPos);
+          last_token[idx++].assign(line, fieldStartPos, fieldEndPos-fieldStartPos);
           fieldStartPos = fieldEndPos + 1;
         }
         else
         {
-          last_token[idx] = line.substr(fieldStartPos);
+          last_token[idx].assign(line, fieldStartPos, std::string::npos);
           break;
         }
       } // tab split loop
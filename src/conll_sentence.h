@@ -0,0 +1,225 @@
+#ifndef CONLL_SENTENCE_H_
+#define CONLL_SENTENCE_H_
+
+#include "atom_table.h"
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <charconv>
+
+
+// Предложение в формате conll: строковые поля токенов, однократно разобранные числовые колонки (ID и HEAD)
+// и атомы строковых колонок FORM, LEMMA и DEPREL (см. AtomTable).
+// Последующие стадии обработки используют числовые массивы и не преобразуют строки в числа и не хэшируют их повторно.
+// Строки токенов переиспользуются от предложения к предложению (очистка не освобождает память полей),
+// поэтому в установившемся режиме чтение предложения не выделяет динамическую память.
+// При структурных изменениях (set_head, erase_tokens) основными являются числовые колонки: строковые поля ID и HEAD
+// не переписываются, пока их явно не восстановит serialize_numeric().
+class ConllSentence
+{
+public:
+  typedef std::vector<std::string> Token;
+  // признак некорректного значения числовой колонки
+  static constexpr int INVALID_NUMBER = -1;
+  // доступ к строковым полям токенов
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  Token& operator[](size_t idx) { return tokens[idx]; }
+  const Token& operator[](size_t idx) const { return tokens[idx]; }
+  std::vector<Token>::iterator begin() { return tokens.begin(); }
+  std::vector<Token>::iterator end() { return tokens.begin() + count; }
+  std::vector<Token>::const_iterator begin() const { return tokens.begin(); }
+  std::vector<Token>::const_iterator end() const { return tokens.begin() + count; }
+  // добавление токена с заданным количеством полей (строки ранее использованного токена переиспользуются)
+  Token& append_row(size_t fieldsCount)
+  {
+    if ( count == tokens.size() )
+      tokens.emplace_back();
+    auto& row = tokens[count++];
+    row.resize(fieldsCount);
+    return row;
+  } // method-end
+  void clear()
+  {
+    count = 0;
+    ids.clear();
+    heads.clear();
+    origins.clear();
+    atoms.clear();
+    heads_valid = true;
+  }
+  void reserve(size_t n)
+  {
+    tokens.reserve(n);
+    ids.reserve(n);
+    heads.reserve(n);
+    origins.reserve(n);
+    atoms.reserve(n * ATOM_COLUMNS_COUNT);
+  }
+  // номер токена (колонка ID; INVALID_NUMBER, если значение некорректно)
+  inline int id(size_t idx) const { return ids[idx]; }
+  // номер синтаксического родителя (колонка HEAD; 0 -- корень; INVALID_NUMBER, если значение некорректно)
+  inline int head(size_t idx) const { return heads[idx]; }
+  // исходный (до удаления токенов) индекс токена в предложении
+  inline int origin(size_t idx) const { return origins[idx]; }
+  // признак того, что колонка HEAD корректна у всех токенов
+  inline bool all_heads_valid() const { return heads_valid; }
+  // атом строкового поля (для колонок FORM, LEMMA и DEPREL берётся из предложения, для прочих -- вычисляется)
+  inline uint32_t atom(size_t idx, size_t column) const
+  {
+    int slot = atom_slot(column);
+    if ( slot >= 0 )
+      return atoms[idx * ATOM_COLUMNS_COUNT + slot];
+    return AtomTable::global().intern(tokens[idx][column]);
+  }
+  // сопоставление строковым полям атомов (выполняется однократно после чтения предложения)
+  // до заморозки таблицы атомов неизвестные строки добавляются в неё, после -- получают INVALID_ATOM
+  void resolve_atoms()
+  {
+    auto& atom_table = AtomTable::global();
+    size_t n = count;
+    atoms.resize(n * ATOM_COLUMNS_COUNT);
+    for (size_t i = 0; i < n; ++i)
+    {
+      auto& t = tokens[i];
+      for (size_t slot = 0; slot < ATOM_COLUMNS_COUNT; ++slot)
+        atoms[i * ATOM_COLUMNS_COUNT + slot] = (t.size() > ATOM_COLUMNS[slot]) ? atom_table.intern(t[ ATOM_COLUMNS[slot] ]) : AtomTable::INVALID_ATOM;
+    }
+  } // method-end
+  // изменение строкового поля токена (атом синхронизируется)
+  void set_field(size_t idx, size_t column, const std::string& value, uint32_t value_atom)
+  {
+    tokens[idx][column] = value;
+    int slot = atom_slot(column);
+    if ( slot >= 0 )
+      atoms[idx * ATOM_COLUMNS_COUNT + slot] = value_atom;
+  } // method-end
+  // разбор числовых колонок (выполняется однократно после чтения предложения)
+  void parse_numeric()
+  {
+    size_t n = count;
+    ids.resize(n);
+    heads.resize(n);
+    origins.resize(n);
+    heads_valid = true;
+    for (size_t i = 0; i < n; ++i)
+    {
+      origins[i] = i;
+      auto& t = tokens[i];
+      ids[i] = (t.size() > 0) ? parse_number(t[0]) : INVALID_NUMBER;
+      heads[i] = (t.size() > 6) ? parse_number(t[6]) : INVALID_NUMBER;
+      if ( heads[i] == INVALID_NUMBER )
+        heads_valid = false;
+    }
+  } // method-end
+  // изменение синтаксического родителя токена
+  void set_head(size_t idx, int value)
+  {
+    heads[idx] = value;
+  } // method-end
+  // удаление группы токенов за один проход с перенумерацией оставшихся токенов и коррекцией ссылок на них
+  // (positions упорядочены по возрастанию; ссылки на сами удаляемые токены должны быть перенаправлены заранее)
+  template<typename PositionsContainer>
+  void erase_tokens(const PositionsContainer& positions)
+  {
+    if ( positions.empty() )
+      return;
+    // уплотнение с построением отображения старых номеров токенов в новые
+    // (удаляемые токены обменом переносятся в резерв за концом предложения вместе с памятью их полей)
+    remap.resize(count);
+    size_t write_pos = 0;
+    auto next_erased = positions.begin();
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+      if ( next_erased != positions.end() && static_cast<size_t>(*next_erased) == idx )
+      {
+        remap[idx] = INVALID_NUMBER;
+        ++next_erased;
+        continue;
+      }
+      remap[idx] = write_pos;
+      if ( write_pos != idx )
+      {
+        std::swap(tokens[write_pos], tokens[idx]);
+        heads[write_pos] = heads[idx];
+        origins[write_pos] = origins[idx];
+        for (size_t slot = 0; slot < ATOM_COLUMNS_COUNT; ++slot)
+          atoms[write_pos * ATOM_COLUMNS_COUNT + slot] = atoms[idx * ATOM_COLUMNS_COUNT + slot];
+      }
+      ++write_pos;
+    }
+    size_t old_count = count;
+    size_t erased_count = old_count - write_pos;
+    count = write_pos;
+    ids.resize(count);
+    heads.resize(count);
+    origins.resize(count);
+    atoms.resize(count * ATOM_COLUMNS_COUNT);
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+      ids[idx] = idx + 1;
+      int h = heads[idx];
+      if ( h >= 1 && static_cast<size_t>(h) <= old_count )
+      {
+        if ( remap[h - 1] != INVALID_NUMBER )
+          heads[idx] = remap[h - 1] + 1;
+      }
+      else if ( h > static_cast<int>(old_count) )
+        heads[idx] = h - erased_count;
+    }
+  } // method-end
+  // запись числовых колонок ID и HEAD в строковые поля (после структурных изменений, для вывода предложения)
+  void serialize_numeric()
+  {
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+      auto& t = tokens[idx];
+      if ( t.size() > 0 && ids[idx] != INVALID_NUMBER )
+        t[0] = std::to_string(ids[idx]);
+      if ( t.size() > 6 && heads[idx] != INVALID_NUMBER )
+        t[6] = std::to_string(heads[idx]);
+    }
+  } // method-end
+private:
+  // колонки, для которых при чтении вычисляются атомы (FORM, LEMMA, DEPREL)
+  static constexpr size_t ATOM_COLUMNS_COUNT = 3;
+  static constexpr size_t ATOM_COLUMNS[ATOM_COLUMNS_COUNT] = {1, 2, 7};
+  // строковые поля токенов (conll-матрица; элементы за пределами count -- резерв для переиспользования)
+  std::vector<Token> tokens;
+  size_t count = 0;
+  // значения колонок ID и HEAD
+  std::vector<int> ids;
+  std::vector<int> heads;
+  bool heads_valid = true;
+  // исходные индексы токенов (сохраняются при удалении токенов)
+  std::vector<int> origins;
+  // атомы строковых колонок (ATOM_COLUMNS_COUNT значений на токен)
+  std::vector<uint32_t> atoms;
+  // отображение старых номеров токенов в новые при удалении (рабочий массив erase_tokens)
+  std::vector<int> remap;
+
+  static inline int atom_slot(size_t column)
+  {
+    switch (column)
+    {
+      case 1: return 0;
+      case 2: return 1;
+      case 7: return 2;
+      default: return -1;
+    }
+  } // method-end
+
+  // разбор неотрицательного целого числа (допускаются завершающие нецифровые символы, как при std::stoi)
+  static int parse_number(const std::string& str)
+  {
+    int value = 0;
+    auto res = std::from_chars(str.data(), str.data() + str.size(), value);
+    if ( res.ec != std::errc() || res.ptr == str.data() || value < 0 )
+      return INVALID_NUMBER;
+    return value;
+  } // method-end
+}; // class-decl-end
+
+
+#endif /* CONLL_SENTENCE_H_ */
@@ -0,0 +1,91 @@
+#ifndef DEP_CONTEXT_INDEX_H_
+#define DEP_CONTEXT_INDEX_H_
+
+#include "original_word2vec_vocabulary.h"
+#include "atom_table.h"
+
+#include <string>
+#include <vector>
+#include <limits>
+#include <cstdint>
+
+
+// Индекс словаря синтаксических контекстов по составному целочисленному ключу (лемма, тип связи, направление).
+// Позволяет находить контекст без конкатенации строк: леммы и типы связей представлены атомами (см. AtomTable),
+// а поиск контекста выполняется по целочисленному ключу в хэш-таблице с открытой адресацией.
+class DepContextIndex
+{
+public:
+  static constexpr size_t INVALID_IDX = std::numeric_limits<size_t>::max();
+  // направление синтаксической связи (с точки зрения родителя / с точки зрения потомка)
+  enum Direction
+  {
+    dirNone = 0,   // контекст без учета типа и направления связи
+    dirHead = 1,   // lemma<deprel
+    dirChild = 2   // lemma>deprel
+  };
+  // построение индекса по словарю синтаксических контекстов
+  void build(const OriginalWord2VecVocabulary& depCtxVocabulary, bool useDeprel)
+  {
+    auto& atom_table = AtomTable::global();
+    size_t capacity = 16;
+    while (capacity < depCtxVocabulary.size() * 2)
+      capacity <<= 1;
+    mask = capacity - 1;
+    keys.assign(capacity, EMPTY_KEY);
+    values.assign(capacity, 0);
+    for (size_t i = 0; i < depCtxVocabulary.size(); ++i)
+    {
+      auto& ctx = depCtxVocabulary.idx_to_data(i).word;
+      size_t pos = useDeprel ? ctx.find_last_of("<>") : std::string::npos;
+      if ( useDeprel && pos == std::string::npos )
+        continue;  // запись без типа связи в этом режиме недостижима
+      uint32_t lemma_id = atom_table.intern( std::string_view(ctx).substr(0, pos) );
+      uint32_t deprel_id = (pos == std::string::npos) ? 0 : atom_table.intern( std::string_view(ctx).substr(pos + 1) );
+      Direction dir = (pos == std::string::npos) ? dirNone : (ctx[pos] == '<' ? dirHead : dirChild);
+      insert(make_key(lemma_id, deprel_id, dir), i);
+    }
+  } // method-end
+  // получение индекса контекста в словаре по атомам леммы и типа связи (INVALID_IDX, если контекст не словарный)
+  inline size_t find(uint32_t lemmaId, uint32_t deprelId, Direction dir) const
+  {
+    if ( lemmaId == AtomTable::INVALID_ATOM || deprelId == AtomTable::INVALID_ATOM )
+      return INVALID_IDX;
+    uint64_t key = make_key(lemmaId, deprelId, dir);
+    for (size_t slot = hash(key); ; slot = (slot + 1) & mask)
+    {
+      if ( keys[slot] == key )
+        return values[slot];
+      if ( keys[slot] == EMPTY_KEY )
+        return INVALID_IDX;
+    }
+  } // method-end
+private:
+  static constexpr uint64_t EMPTY_KEY = std::numeric_limits<uint64_t>::max();
+  // хэш-таблица с открытой адресацией (линейное пробирование): составной ключ -> индекс контекста в словаре
+  std::vector<uint64_t> keys;
+  std::vector<uint32_t> values;
+  size_t mask = 0;
+
+  // составной ключ: 32 бита леммы, 30 бит типа связи, 2 бита направления
+  static inline uint64_t make_key(uint32_t lemmaId, uint32_t deprelId, Direction dir)
+  {
+    return (static_cast<uint64_t>(lemmaId) << 32) | (static_cast<uint64_t>(deprelId) << 2) | dir;
+  } // method-end
+  inline size_t hash(uint64_t key) const
+  {
+    return ((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+  } // method-end
+  void insert(uint64_t key, size_t idx)
+  {
+    size_t slot = hash(key);
+    while ( keys[slot] != EMPTY_KEY && keys[slot] != key )
+      slot = (slot + 1) & mask;
+    // при дублировании записей в словаре действует последняя (как и при поиске по строке)
+    keys[slot] = key;
+    values[slot] = idx;
+  } // method-end
+}; // class-decl-end
+
+
+#endif /* DEP_CONTEXT_INDEX_H_ */
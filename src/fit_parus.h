@@ -126,7 +126,7 @@ private:
   // исправление типа синтаксической связи у знаков пунктуации
   void process_punc(u32SentenceMatrix& data)
   {
-    std::set<std::u32string> puncts = { U".", U",", U"!", U"?", U":", U";", U"…", U"...", U"--", U"—", U"–", U"‒",
+    static const std::set<std::u32string> puncts = { U".", U",", U"!", U"?", U":", U";", U"…", U"...", U"--", U"—", U"–", U"‒",
                                         U"'", U"ʼ", U"ˮ", U"\"", U"«", U"»", U"“", U"”", U"„", U"‟", U"‘", U"’", U"‚", U"‛",
                                         U"(", U")", U"[", U"]", U"{", U"}", U"⟨", U"⟩" };
     for (auto& t : data)
@@ -146,10 +146,10 @@ private:
   void process_nums(u32SentenceMatrix& data)
   {
     // превращаем числа в @num@
-    const std::u32string CARD = U"@card@";
-    const std::u32string NUM  = U"@num@";
-    const std::u32string Digs = U"0123456789";
-    const std::u32string RuLets = U"АБВГДЕЁЖЗИЙКЛМНОПРСТУФХЦЧШЩЬЫЪЭЮЯабвгдеёжзийклмнопрстуфхцчшщьыъэюя";
+    static const std::u32string CARD = U"@card@";
+    static const std::u32string NUM  = U"@num@";
+    static const std::u32string Digs = U"0123456789";
+    static const std::u32string RuLets = U"АБВГДЕЁЖЗИЙКЛМНОПРСТУФХЦЧШЩЬЫЪЭЮЯабвгдеёжзийклмнопрстуфхцчшщьыъэюя";
     for (auto& t : data)
     {
       auto& token = t[1];
@@ -193,7 +193,7 @@ private:
   } // method-end
   void reltypes_filter(u32SentenceMatrix& data)
   {
-    const std::set<std::u32string> permissible_reltypes = {
+    static const std::set<std::u32string> permissible_reltypes = {
         U"предик", U"агент", U"квазиагент", U"дат-субъект",
         U"присвяз", U"аналит", U"пасс-анал",
         U"1-компл", U"2-компл", U"3-компл", U"4-компл", U"неакт-компл",
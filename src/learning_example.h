@@ -1,15 +1,28 @@
 #ifndef LEARNING_EXAMPLE_H_
 #define LEARNING_EXAMPLE_H_
 
-#include <vector>
+#include <cstddef>
+
+
+// непрерывный фрагмент массива индексов (не владеет данными)
+struct IndexSlice
+{
+  const size_t* first = nullptr;
+  const size_t* last = nullptr;
+  const size_t* begin() const { return first; }
+  const size_t* end() const { return last; }
+  size_t size() const { return last - first; }
+  bool empty() const { return first == last; }
+};
 
 
 // структура, представляющая обучающий пример
+// контексты ссылаются на хранилище поставщика обучающих примеров и действительны до считывания потоком следующего предложения
 struct LearningExample
 {
   size_t word;                         // индекс слова
-  std::vector<size_t> dep_context;     // индексы синтаксических контекстов
-  std::vector<size_t> assoc_context;   // индексы ассоциативных контекстов
+  IndexSlice dep_context;              // индексы синтаксических контекстов
+  IndexSlice assoc_context;            // индексы ассоциативных контекстов (для всего предложения или окна вокруг слова, включая, возможно, само слово)
 };
 
 
@@ -5,36 +5,89 @@
 #include "learning_example.h"
 #include "original_word2vec_vocabulary.h"
 #include "mwe_vocabulary.h"
+#include "mwe_substitution_cache.h"
+#include "dep_context_index.h"
+#include "philox.h"
+#include "chunk_scheduler.h"
 
 #include <memory>
 #include <vector>
 #include <optional>
+#include <algorithm>
 #include <cstring>       // for std::strerror
 #include <cmath>
+#include <atomic>
+
+
+// предложение, преобразованное в обучающие примеры
+// (контексты примеров ссылаются на хранилища самого предложения, поэтому предложения можно накапливать в буфере и обменивать местами)
+struct CompiledSentence
+{
+  std::vector< LearningExample > examples;   // обучающие примеры предложения
+  size_t position = 0;                       // текущая позиция в предложении
+  std::vector<size_t> dep_offsets;           // смещения контекстов токенов в dep_arena (CSR; размер -- число токенов + 1)
+  std::vector<size_t> dep_arena;             // синтаксические контексты предложения, сгруппированные по токенам
+  std::vector<size_t> assoc_arena;           // ассоциативные контексты предложения (упорядочены, без повторов; в оконном режиме -- в порядке следования)
+  std::vector<size_t> assoc_window_offsets;  // смещения окон ассоциаций примеров в assoc_window_arena (CSR; размер -- число примеров + 1)
+  std::vector<size_t> assoc_window_arena;    // окна ассоциаций примеров (без повторов; при ограничении числа -- случайная выборка)
+};
 
 
 // информация, описывающая рабочий контекст одного потока управления (thread)
 struct ThreadEnvironment
 {
   FILE* fi;                                            // хэндлер файла, содержащего обучающее множество (открывается с позиции, рассчитанной для данного потока управления).
-  std::vector< LearningExample > sentence;             // последнее считанное предложение
-  int position_in_sentence;                            // текущая позиция в предложении
   unsigned long long next_random;                      // поле для вычисления случайных величин
   unsigned long long words_count;                      // количество прочитанных словарных слов
-  std::vector< std::vector<std::string> > sentence_matrix; // conll-матрица для предложения
+  ConllSentence sentence_matrix;                       // conll-матрица для предложения
+  std::vector< std::pair<size_t, size_t> > dep_links;  // синтаксические контексты предложения в порядке обнаружения (номер токена, индекс контекста)
+  std::vector<size_t> assoc_sample_ids;                // индексы ассоциаций в словаре ассоциативных контекстов (для сабсэмплинга)
+  std::vector<size_t> assoc_positions;                 // позиции ассоциаций в предложении (для оконного режима)
+  std::vector<size_t> word_ids;                        // индексы слов предложения в словаре векторной модели
+  std::vector<size_t> word_positions;                  // позиции словарных слов в предложении (после сабсэмплинга)
+  std::vector<uint16_t> random16;                      // пакет 16-битных случайных величин для сабсэмплинга
+  std::vector<uint32_t> assoc_stamps;                  // отметки ассоциаций, уже попавших в окно (индексируются индексом ассоциации)
+  uint32_t assoc_stamp;                                // отметка текущего окна ассоциаций
+  uint32_t epoch_no;                                   // номер текущей эпохи (для воспроизводимого режима)
+  uint64_t sentence_no;                                // номер считанного предложения в пределах эпохи (для воспроизводимого режима)
+  CompiledSentence current;                            // предложение, по которому выполняется итерирование
+  std::vector<CompiledSentence> reservoir;             // буфер перемешивания предложений
+  bool shard_exhausted;                                // признак того, что часть обучающего множества, закреплённая за потоком, считана до конца
+  uint64_t chunk_end;                                  // граница обрабатываемой порции обучающего множества (для потокового режима)
   ThreadEnvironment()
   : fi(nullptr)
-  , position_in_sentence(-1)
   , next_random(0)
   , words_count(0)
+  , epoch_no(0)
+  , sentence_no(0)
+  , assoc_stamp(0)
+  , shard_exhausted(false)
+  , chunk_end(0)
   {
-    sentence.reserve(1000);
+    current.examples.reserve(1000);
     sentence_matrix.reserve(1000);
   }
   inline void update_random()
   {
     next_random = next_random * (unsigned long long)25214903917 + 11;
   }
+  // пакетное вычисление n 16-битных случайных величин (Philox, по 8 величин на блок)
+  // величины определяются значением next_random (зерном предложения), номером стадии обработки, номером пакета в пределах стадии
+  // (subStream -- для стадий, выполняющих несколько независимых выборок в одном предложении) и позицией в пакете
+  void draw_random16(uint32_t stage, size_t n, uint32_t subStream = 0)
+  {
+    random16.resize((n + 7) & ~static_cast<size_t>(7));
+    uint32_t out[4];
+    for (size_t pos = 0; pos < n; pos += 8)
+    {
+      Philox::block(next_random, static_cast<uint32_t>(pos / 8), subStream, stage, 0, out);
+      for (size_t j = 0; j < 4; ++j)
+      {
+        random16[pos + 2*j]     = static_cast<uint16_t>(out[j]);
+        random16[pos + 2*j + 1] = static_cast<uint16_t>(out[j] >> 16);
+      }
+    }
+  }
 };
 
 
@@ -51,7 +104,10 @@ public:
                           std::shared_ptr<OriginalWord2VecVocabulary> depCtxVocabulary, std::shared_ptr<OriginalWord2VecVocabulary> assocCtxVocabulary,
                           std::shared_ptr<MweVocabulary> mweVocabulary,
                           size_t embColumn, size_t depColumn, bool useDeprel,
-                          float wordsSubsample, float depSubsample, float assocSubsample)
+                          float wordsSubsample, float depSubsample, float assocSubsample,
+                          bool deterministicMode = false, size_t shuffleBufferSize = 0,
+                          size_t assocWindow = 0, size_t assocMax = 0,
+                          std::shared_ptr<MweSubstitutionCache> mweCache = nullptr)
   : threads_count(threadsCount)
   , train_filename(trainFilename)
   , words_vocabulary(wordsVocabulary)
@@ -59,12 +115,17 @@ public:
   , dep_ctx_vocabulary(depCtxVocabulary)
   , assoc_ctx_vocabulary(assocCtxVocabulary)
   , mwe_vocabulary(mweVocabulary)
+  , mwe_cache(mweCache)
   , emb_column(embColumn)
   , dep_column(depColumn)
   , use_deprel(useDeprel)
   , sample_w(wordsSubsample)
   , sample_d(depSubsample)
   , sample_a(assocSubsample)
+  , deterministic(deterministicMode)
+  , shuffle_size(shuffleBufferSize)
+  , assoc_window(assocWindow)
+  , assoc_max(assocMax)
   {
     thread_environment.resize(threads_count);
     for (size_t i = 0; i < threads_count; ++i)
@@ -73,11 +134,20 @@ public:
     {
       train_words = words_vocabulary->cn_sum();
       words_vocabulary->sampling_estimation(wordsSubsample);
+      words_vocabulary->build_atom_index();
     }
     if ( dep_ctx_vocabulary )
+    {
       dep_ctx_vocabulary->sampling_estimation(depSubsample);
+      dep_ctx_index.build(*dep_ctx_vocabulary, use_deprel);
+    }
     if ( assoc_ctx_vocabulary )
+    {
       assoc_ctx_vocabulary->sampling_estimation(assocSubsample);
+      assoc_ctx_vocabulary->build_atom_index();
+    }
+    // все справочники построены: дальше таблица атомов только читается (без блокировок) потоками обучения
+    AtomTable::global().freeze();
     try
     {
       train_file_size = get_file_size(train_filename);
@@ -85,6 +155,12 @@ public:
       std::cerr << "LearningExampleProvider can't get file size for: " << train_filename << "\n  " << e.what() << std::endl;
       train_file_size = 0;
     }
+    // в многопоточном режиме эпохи делятся на порции, распределяемые динамически (в воспроизводимом -- статически по частям)
+    if ( train_file_size > 0 && !deterministic && build_chunk_directory() )
+    {
+      chunked = true;
+      chunk_scheduler.reset(chunk_bounds.size() - 1, threads_count);
+    }
   } // constructor-end
   // деструктор
   ~LearningExampleProvider()
@@ -102,20 +178,32 @@ public:
       std::cerr << "LearningExampleProvider: epoch prepare error: " << std::strerror(errno) << std::endl;
       return false;
     }
-    int succ = fseek(t_environment.fi, train_file_size / threads_count * threadIndex, SEEK_SET);
-    if (succ != 0)
+    if ( chunked )
     {
-      std::cerr << "LearningExampleProvider: epoch prepare error: " << std::strerror(errno) << std::endl;
-      return false;
+      // порции эпохи будут захватываться по мере чтения (первая -- при первом чтении)
+      chunk_scheduler.prepare(t_environment.epoch_no);
+      t_environment.chunk_end = 0;
+    }
+    else
+    {
+      int succ = fseek(t_environment.fi, train_file_size / threads_count * threadIndex, SEEK_SET);
+      if (succ != 0)
+      {
+        std::cerr << "LearningExampleProvider: epoch prepare error: " << std::strerror(errno) << std::endl;
+        return false;
+      }
+      // т.к. после смещения мы типично не оказываемся в начале предложения, выполним выравнивание на начало предложения
+      std::vector< std::vector<std::string> > stub;
+      ConllReader::read_sentence(t_environment.fi, stub); // один read_sentence не гарантирует выход на начало предложения, т.к. fseek может поставить нас прямо на перевод строки в конце очередного токена, что распознается, как пустая строка
+      stub.clear();
+      ConllReader::read_sentence(t_environment.fi, stub);
     }
-    // т.к. после смещения мы типично не оказываемся в начале предложения, выполним выравнивание на начало предложения
-    std::vector< std::vector<std::string> > stub;
-    ConllReader::read_sentence(t_environment.fi, stub); // один read_sentence не гарантирует выход на начало предложения, т.к. fseek может поставить нас прямо на перевод строки в конце очередного токена, что распознается, как пустая строка
-    stub.clear();
-    ConllReader::read_sentence(t_environment.fi, stub);
-    t_environment.sentence.clear();
-    t_environment.position_in_sentence = 0;
+    t_environment.current.examples.clear();
+    t_environment.current.position = 0;
+    t_environment.reservoir.clear();
+    t_environment.shard_exhausted = false;
     t_environment.words_count = 0;
+    t_environment.sentence_no = 0;
     return true;
   } // method-end
   // заключительные действия, выполняемые после каждой эпохой обучения
@@ -124,153 +212,57 @@ public:
     auto& t_environment = thread_environment[threadIndex];
     fclose( t_environment.fi );
     t_environment.fi = nullptr;
+    ++t_environment.epoch_no;
     return true;
   } // method-end
-  // получение очередного обучающего примера
-  std::optional<LearningExample> get(size_t threadIndex)
+  // запуск потокового режима: обучающее множество, повторённое epochCount раз, рассматривается как единый поток порций,
+  // которые потоки управления захватывают по мере освобождения (вызывается однократно до запуска потоков)
+  bool stream_start(size_t epochCount)
+  {
+    if ( train_file_size == 0 || !build_chunk_directory() )
+      return false;
+    streaming = true;
+    chunked = true;
+    stream_total = epochCount * (chunk_bounds.size() - 1);
+    stream_cursor = 0;
+    return true;
+  } // method-end
+  // подготовительные действия потока управления в потоковом режиме
+  bool stream_prepare(size_t threadIndex)
   {
     auto& t_environment = thread_environment[threadIndex];
-
-    if (t_environment.sentence.empty())
+    t_environment.fi = fopen(train_filename.c_str(), "rb");
+    if ( t_environment.fi == nullptr )
     {
-      t_environment.position_in_sentence = 0;
-      if ( t_environment.words_count > train_words / threads_count ) // не настал ли конец эпохи?
-        return std::nullopt;
-      while (true)
-      {
-        auto& sentence_matrix = t_environment.sentence_matrix;
-        sentence_matrix.clear();
-        bool succ = ConllReader::read_sentence(t_environment.fi, sentence_matrix);
-        if ( feof(t_environment.fi) ) // не настал ли конец эпохи?
-          return std::nullopt;
-        if ( !succ )
-          continue;
-        auto sm_size = sentence_matrix.size();
-        if (sm_size == 0)
-          continue;
-        // проконтролируем, что номер первого токена равен единице
-        try {
-          int tn = std::stoi( sentence_matrix[0][0] );
-          if (tn != 1) continue;
-        } catch (...) {
-          continue;
-        }
-        // добавим в предложение фразы (преобразуя sentence_matrix)
-        if (mwe_vocabulary)
-        {
-          mwe_vocabulary->put_phrases_into_sentence(sentence_matrix);
-          sm_size = sentence_matrix.size();
-        }
-        // конвертируем conll-таблицу в более удобные структуры
-        const size_t INVALID_IDX = std::numeric_limits<size_t>::max();
-        std::vector< std::vector<size_t> > deps( sm_size );  // хранилище синатксических контекстов для каждого токена
-        std::set<size_t> associations;                       // хранилище ассоциативных контекстов для всего предложения
-        if ( dep_ctx_vocabulary )
-        {
-          for (size_t i = 0; i < sm_size; ++i)
-          {
-            auto& token = sentence_matrix[i];
-            size_t parent_token_no = 0;
-            try {
-              parent_token_no = std::stoi(token[6]);
-            } catch (...) {
-              parent_token_no = 0; // если конвертирование неудачно, считаем, что нет родителя
-            }
-            if ( parent_token_no < 1 || parent_token_no > sm_size ) continue;
-
-            // рассматриваем контекст с точки зрения родителя в синтаксической связи
-            auto ctx__from_head_viewpoint = ( use_deprel ? token[dep_column] + "<" + token[7] : token[dep_column] );
-            auto ctx__fhvp_idx = dep_ctx_vocabulary->word_to_idx( ctx__from_head_viewpoint );
-            if ( ctx__fhvp_idx != INVALID_IDX )
-              deps[ parent_token_no - 1 ].push_back( ctx__fhvp_idx );
-            // рассматриваем контекст с точки зрения потомка в синтаксической связи
-            auto& parent = sentence_matrix[ parent_token_no - 1 ];
-            auto ctx__from_child_viewpoint = (use_deprel ? parent[dep_column] + ">" + token[7] : parent[dep_column] );
-            auto ctx__fcvp_idx = dep_ctx_vocabulary->word_to_idx( ctx__from_child_viewpoint );
-            if ( ctx__fcvp_idx != INVALID_IDX )
-              deps[ i ].push_back( ctx__fcvp_idx );
-          }
-          if (sample_d > 0)
-          {
-            for (size_t i = 0; i < sm_size; ++i)
-            {
-              auto tdcIt = deps[i].begin();
-              while (tdcIt != deps[i].end())
-              {
-                float ran = dep_ctx_vocabulary->idx_to_data(*tdcIt).sample_probability;
-                t_environment.update_random();
-                if (ran < (t_environment.next_random & 0xFFFF) / (float)65536)
-                  tdcIt = deps[i].erase(tdcIt);
-                else
-                  ++tdcIt;
-              }
-            }
-          }
-        }
-        if ( assoc_ctx_vocabulary )
-        {
-          for (auto& rec : sentence_matrix)
-          {
-            size_t assoc_idx = assoc_ctx_vocabulary->word_to_idx(rec[2]);       // lemma column
-            if ( assoc_idx == INVALID_IDX )
-              continue;
-            // применяем сабсэмплинг к ассоциациям
-            if (sample_a > 0)
-            {
-              float ran = assoc_ctx_vocabulary->idx_to_data(assoc_idx).sample_probability;
-              t_environment.update_random();
-              if (ran < (t_environment.next_random & 0xFFFF) / (float)65536)
-                continue;
-            }
-            if (!proper_names)
-            {
-              auto word_idx = words_vocabulary->word_to_idx(rec[emb_column]);
-              if ( word_idx == INVALID_IDX )
-                continue;
-              associations.insert(word_idx);
-            }
-            else
-              associations.insert(assoc_idx);
-          } // for all words in sentence
-        }
-        // конвертируем в структуру для итерирования (фильтрация несловарных, фильтрация вершин словосочетаний)
-        for (size_t i = 0; i < sm_size; ++i)
-        {
-          auto word_idx = words_vocabulary->word_to_idx(sentence_matrix[i][emb_column]);
-          if ( word_idx != INVALID_IDX )
-            ++t_environment.words_count;
-          if ( word_idx != INVALID_IDX )
-          {
-            if (sample_w > 0)
-            {
-              float ran = words_vocabulary->idx_to_data(word_idx).sample_probability;
-              t_environment.update_random();
-              if (ran < (t_environment.next_random & 0xFFFF) / (float)65536)
-                continue;
-            }
-            LearningExample le;
-            le.word = word_idx;
-            le.dep_context = deps[i];
-            //std::copy(associations.begin(), associations.end(), std::back_inserter(le.assoc_context));   // текущее слово считаем себе ассоциативным
-            std::copy_if( associations.begin(), associations.end(), std::back_inserter(le.assoc_context),
-                          [word_idx](const size_t a_idx) {return (a_idx != word_idx);} );                  // текущее слово не считаем себе ассоциативным
-            t_environment.sentence.push_back(le);
-          }
-        }
-        if ( t_environment.sentence.empty() )
-          continue;
-        break;
-      }
+      std::cerr << "LearningExampleProvider: stream prepare error: " << std::strerror(errno) << std::endl;
+      return false;
     }
-
-    // при выходе из цикла выше в t_environment.sentence должно быть полезное предложение
-    // итерируем по нему
-    LearningExample result;
-    result = t_environment.sentence[t_environment.position_in_sentence++];
-    if ( t_environment.position_in_sentence == static_cast<int>(t_environment.sentence.size()) )
-      t_environment.sentence.clear();
-    return result;
+    t_environment.current.examples.clear();
+    t_environment.current.position = 0;
+    t_environment.reservoir.clear();
+    t_environment.shard_exhausted = false;
+    t_environment.chunk_end = 0;   // порция будет захвачена при первом чтении
+    t_environment.words_count = 0;
+    return true;
+  } // method-end
+  // заключительные действия потока управления в потоковом режиме
+  bool stream_unprepare(size_t threadIndex)
+  {
+    return epoch_unprepare(threadIndex);
   } // method-end
+  // получение очередного обучающего примера
+  std::optional<LearningExample> get(size_t threadIndex)
+  {
+    auto& current = thread_environment[threadIndex].current;
+    if ( current.position == current.examples.size() && !next_sentence(threadIndex) )
+      return std::nullopt;
+    return current.examples[current.position++];
+  } // method-end
+  // переопределение количества слов в обучающем множестве (при дообучении словарь содержит частоты по всем порциям данных)
+  void set_train_words(uint64_t trainWords)
+  {
+    train_words = trainWords;
+  }
   // получение количества слов, фактически считанных из обучающего множества (т.е. без учета сабсэмплинга)
   uint64_t getWordsCount(size_t threadIndex) const
   {
@@ -292,7 +284,11 @@ private:
   bool proper_names;  // признак того, что выполняется обучение векторных представлений для собственных имен
   std::shared_ptr< OriginalWord2VecVocabulary > dep_ctx_vocabulary;
   std::shared_ptr< OriginalWord2VecVocabulary > assoc_ctx_vocabulary;
+  // индекс словаря синтаксических контекстов по составному ключу (лемма, тип связи, направление)
+  DepContextIndex dep_ctx_index;
   std::shared_ptr< MweVocabulary > mwe_vocabulary;
+  // кэш встраивания словосочетаний (только для чтения; nullptr -- словосочетания ищутся в каждом предложении)
+  std::shared_ptr< MweSubstitutionCache > mwe_cache;
   // номера колонок в conll, откуда считывать данные
   size_t emb_column;
   size_t dep_column;
@@ -304,7 +300,387 @@ private:
   float sample_d = 0;
   // порог для алгоритма сэмплирования (subsampling) -- для ассоциативных контекстов
   float sample_a = 0;
+  // признак воспроизводимого режима (случайные величины вычисляются по позиции в обучающем множестве)
+  bool deterministic = false;
+  // размер буфера перемешивания предложений (0 -- предложения выдаются в порядке следования в файле)
+  size_t shuffle_size = 0;
+  // полуширина окна ассоциативных контекстов (0 -- ассоциации общие для всего предложения)
+  size_t assoc_window = 0;
+  // максимальное количество ассоциативных контекстов на обучающий пример (0 -- без ограничения)
+  size_t assoc_max = 0;
+  // признак чтения обучающего множества динамически распределяемыми порциями
+  bool chunked = false;
+  // признак потокового режима (эпохи не разделяются, порции раздаются сквозным счётчиком)
+  bool streaming = false;
+  // каталог порций обучающего множества (смещения начал порций и размер файла)
+  std::vector<uint64_t> chunk_bounds;
+  static constexpr uint64_t CHUNK_SIZE = 1 << 20;
+  static constexpr uint64_t MIN_CHUNK_SIZE = 1 << 16;
+  // распределение порций между потоками в пределах эпохи (с перехватом работы)
+  ChunkScheduler chunk_scheduler;
+  // номер следующей раздаваемой порции (сквозной по эпохам) и общее количество порций
+  std::atomic<size_t> stream_cursor{0};
+  size_t stream_total = 0;
+  // номера стадий сабсэмплинга (независимые потоки случайных величин в пределах предложения)
+  static constexpr uint32_t SAMPLING_STAGE_DEP = 0;
+  static constexpr uint32_t SAMPLING_STAGE_ASSOC = 1;
+  static constexpr uint32_t SAMPLING_STAGE_WORDS = 2;
+  static constexpr uint32_t SAMPLING_STAGE_ASSOC_SHUFFLE = 3;
+  static constexpr uint32_t SAMPLING_STAGE_ASSOC_CAP = 4;
+
+  // переход к следующему предложению (без буфера перемешивания -- к следующему в файле, иначе -- к случайно выбранному из буфера)
+  bool next_sentence(size_t threadIndex)
+  {
+    auto& t_environment = thread_environment[threadIndex];
+    if (shuffle_size == 0)
+      return compile_sentence(threadIndex, t_environment.current);
+    auto& reservoir = t_environment.reservoir;
+    // наполняем буфер (в начале эпохи)
+    while ( !t_environment.shard_exhausted && reservoir.size() < shuffle_size )
+    {
+      reservoir.emplace_back();
+      if ( !compile_sentence(threadIndex, reservoir.back()) )
+      {
+        reservoir.pop_back();
+        t_environment.shard_exhausted = true;
+      }
+    }
+    if ( reservoir.empty() )
+      return false;
+    // выбираем предложение из буфера, а на его место считываем следующее (хранилища отработанного предложения переиспользуются)
+    t_environment.update_random();
+    size_t slot = (t_environment.next_random >> 16) % reservoir.size();
+    std::swap(t_environment.current, reservoir[slot]);
+    if ( t_environment.shard_exhausted || !compile_sentence(threadIndex, reservoir[slot]) )
+    {
+      // часть обучающего множества исчерпана -- буфер вычерпывается до конца
+      t_environment.shard_exhausted = true;
+      std::swap(reservoir[slot], reservoir.back());
+      reservoir.pop_back();
+    }
+    return true;
+  } // method-end
+  // считывание следующего предложения и его преобразование в обучающие примеры (false -- конец эпохи)
+  bool compile_sentence(size_t threadIndex, CompiledSentence& out)
+  {
+    auto& t_environment = thread_environment[threadIndex];
+    out.examples.clear();
+    out.position = 0;
+    if ( !chunked && t_environment.words_count > train_words / threads_count ) // не настал ли конец эпохи?
+      return false;
+    while (true)
+    {
+      // при чтении по порциям по исчерпании порции захватывается следующая (предложение относится к порции, в которой начинается)
+      if ( chunked && static_cast<uint64_t>(ftell(t_environment.fi)) >= t_environment.chunk_end && !claim_chunk(threadIndex) )
+        return false;
+      auto& sentence_matrix = t_environment.sentence_matrix;
+      sentence_matrix.clear();
+      uint64_t sentence_offset = mwe_cache ? ftell(t_environment.fi) : 0;
+      bool succ = ConllReader::read_sentence(t_environment.fi, sentence_matrix);
+      if ( feof(t_environment.fi) ) // не настал ли конец эпохи?
+      {
+        if ( !chunked )
+          return false;
+        t_environment.chunk_end = 0;
+        continue;
+      }
+      // в воспроизводимом режиме случайные величины предложения определяются его позицией в части обучающего множества
+      if (deterministic)
+        t_environment.next_random = Philox::at( Philox::make_key(threadIndex, t_environment.epoch_no), t_environment.sentence_no++ );
+      if ( !succ )
+        continue;
+      auto sm_size = sentence_matrix.size();
+      if (sm_size == 0)
+        continue;
+      // проконтролируем, что номер первого токена равен единице
+      if ( sentence_matrix.id(0) != 1 )
+        continue;
+      // добавим в предложение фразы (преобразуя sentence_matrix)
+      if (mwe_vocabulary)
+      {
+        if (mwe_cache)
+          mwe_cache->substitute(*mwe_vocabulary, sentence_matrix, sentence_offset);
+        else
+          mwe_vocabulary->put_phrases_into_sentence(sentence_matrix);
+        sm_size = sentence_matrix.size();
+      }
+      // конвертируем conll-таблицу в более удобные структуры
+      // (контексты всех токенов размещаются в плоских хранилищах потока, обучающие примеры ссылаются на их фрагменты)
+      const size_t INVALID_IDX = std::numeric_limits<size_t>::max();
+      auto& dep_links = t_environment.dep_links;
+      auto& dep_offsets = out.dep_offsets;
+      auto& dep_arena = out.dep_arena;
+      auto& assoc_arena = out.assoc_arena;
+      dep_links.clear();
+      dep_offsets.assign(sm_size + 1, 0);
+      dep_arena.clear();
+      assoc_arena.clear();
+      if ( dep_ctx_vocabulary )
+      {
+        // контексты ищутся по атомам леммы и типа связи, вычисленным при чтении предложения
+        const auto DIR_HEAD = use_deprel ? DepContextIndex::dirHead : DepContextIndex::dirNone;
+        const auto DIR_CHILD = use_deprel ? DepContextIndex::dirChild : DepContextIndex::dirNone;
+        for (size_t i = 0; i < sm_size; ++i)
+        {
+          int head = sentence_matrix.head(i);
+          size_t parent_token_no = (head == ConllSentence::INVALID_NUMBER) ? 0 : head;  // если значение некорректно, считаем, что нет родителя
+          if ( parent_token_no < 1 || parent_token_no > sm_size ) continue;
 
+          // рассматриваем контекст с точки зрения родителя в синтаксической связи (lemma<deprel)
+          uint32_t deprel = use_deprel ? sentence_matrix.atom(i, 7) : 0;
+          auto ctx__fhvp_idx = dep_ctx_index.find( sentence_matrix.atom(i, dep_column), deprel, DIR_HEAD );
+          if ( ctx__fhvp_idx != INVALID_IDX )
+            dep_links.emplace_back( parent_token_no - 1, ctx__fhvp_idx );
+          // рассматриваем контекст с точки зрения потомка в синтаксической связи (parent_lemma>deprel)
+          auto ctx__fcvp_idx = dep_ctx_index.find( sentence_matrix.atom(parent_token_no - 1, dep_column), deprel, DIR_CHILD );
+          if ( ctx__fcvp_idx != INVALID_IDX )
+            dep_links.emplace_back( i, ctx__fcvp_idx );
+        }
+        // группируем контексты по токенам (устойчивая сортировка подсчётом)
+        for (auto& link : dep_links)
+          ++dep_offsets[link.first + 1];
+        for (size_t i = 0; i < sm_size; ++i)
+          dep_offsets[i + 1] += dep_offsets[i];
+        dep_arena.resize(dep_links.size());
+        for (auto& link : dep_links)
+          dep_arena[ dep_offsets[link.first]++ ] = link.second;
+        for (size_t i = sm_size; i > 0; --i)   // после заполнения смещения сдвинуты на одну группу вперёд
+          dep_offsets[i] = dep_offsets[i - 1];
+        dep_offsets[0] = 0;
+        if (sample_d > 0)
+        {
+          // сабсэмплинг с уплотнением хранилища на месте (без ветвлений: элемент копируется всегда, а позиция записи сдвигается только для сохраняемых)
+          t_environment.draw_random16(SAMPLING_STAGE_DEP, dep_arena.size());
+          auto rnd = t_environment.random16.data();
+          size_t write_pos = 0, group_begin = 0;
+          for (size_t i = 0; i < sm_size; ++i)
+          {
+            size_t group_end = dep_offsets[i + 1];
+            dep_offsets[i] = write_pos;
+            for (size_t k = group_begin; k < group_end; ++k)
+            {
+              size_t ctx_idx = dep_arena[k];
+              dep_arena[write_pos] = ctx_idx;
+              write_pos += ( rnd[k] < dep_ctx_vocabulary->idx_to_sample_threshold(ctx_idx) );
+            }
+            group_begin = group_end;
+          }
+          dep_offsets[sm_size] = write_pos;
+          dep_arena.resize(write_pos);
+        }
+      }
+      auto& assoc_positions = t_environment.assoc_positions;
+      assoc_positions.clear();
+      if ( assoc_ctx_vocabulary )
+      {
+        auto& assoc_sample_ids = t_environment.assoc_sample_ids;
+        assoc_sample_ids.clear();
+        for (size_t i = 0; i < sm_size; ++i)
+        {
+          size_t assoc_idx = assoc_ctx_vocabulary->atom_to_idx( sentence_matrix.atom(i, 2) );       // lemma column
+          if ( assoc_idx == INVALID_IDX )
+            continue;
+          if (!proper_names)
+          {
+            auto word_idx = words_vocabulary->atom_to_idx( sentence_matrix.atom(i, emb_column) );
+            if ( word_idx == INVALID_IDX )
+              continue;
+            assoc_arena.push_back(word_idx);
+          }
+          else
+            assoc_arena.push_back(assoc_idx);
+          assoc_sample_ids.push_back(assoc_idx);
+          assoc_positions.push_back(i);
+        } // for all words in sentence
+        // применяем сабсэмплинг к ассоциациям (по частотам словаря ассоциативных контекстов)
+        if (sample_a > 0)
+        {
+          t_environment.draw_random16(SAMPLING_STAGE_ASSOC, assoc_arena.size());
+          auto rnd = t_environment.random16.data();
+          size_t write_pos = 0;
+          for (size_t k = 0; k < assoc_arena.size(); ++k)
+          {
+            assoc_arena[write_pos] = assoc_arena[k];
+            assoc_positions[write_pos] = assoc_positions[k];
+            write_pos += ( rnd[k] < assoc_ctx_vocabulary->idx_to_sample_threshold(assoc_sample_ids[k]) );
+          }
+          assoc_arena.resize(write_pos);
+          assoc_positions.resize(write_pos);
+        }
+        if (assoc_window == 0)
+        {
+          std::sort(assoc_arena.begin(), assoc_arena.end());
+          assoc_arena.erase( std::unique(assoc_arena.begin(), assoc_arena.end()), assoc_arena.end() );
+          // при ограничении числа ассоциаций перемешиваем множество: любой его непрерывный фрагмент является случайной выборкой
+          if ( assoc_max > 0 && assoc_arena.size() > assoc_max )
+          {
+            t_environment.draw_random16(SAMPLING_STAGE_ASSOC_SHUFFLE, assoc_arena.size());
+            auto rnd = t_environment.random16.data();
+            for (size_t k = assoc_arena.size() - 1; k > 0; --k)
+              std::swap( assoc_arena[k], assoc_arena[ (rnd[k] * (k + 1)) >> 16 ] );
+          }
+        }
+        // в оконном режиме ассоциации остаются в порядке следования в предложении (assoc_positions упорядочен по возрастанию)
+      }
+      // конвертируем в структуру для итерирования (фильтрация несловарных, фильтрация вершин словосочетаний)
+      // текущее слово не считается себе ассоциативным -- это учитывается при обучении (ассоциации общие для всего предложения или окна)
+      IndexSlice associations { assoc_arena.data(), assoc_arena.data() + assoc_arena.size() };
+      auto& word_ids = t_environment.word_ids;
+      auto& word_positions = t_environment.word_positions;
+      word_ids.resize(sm_size);
+      word_positions.clear();
+      for (size_t i = 0; i < sm_size; ++i)
+      {
+        word_ids[i] = words_vocabulary->atom_to_idx( sentence_matrix.atom(i, emb_column) );
+        if ( word_ids[i] != INVALID_IDX )
+          word_positions.push_back(i);
+      }
+      t_environment.words_count += word_positions.size();
+      if (sample_w > 0)
+      {
+        t_environment.draw_random16(SAMPLING_STAGE_WORDS, word_positions.size());
+        auto rnd = t_environment.random16.data();
+        size_t write_pos = 0;
+        for (size_t k = 0; k < word_positions.size(); ++k)
+        {
+          size_t pos = word_positions[k];
+          word_positions[write_pos] = pos;
+          write_pos += ( rnd[k] < words_vocabulary->idx_to_sample_threshold(word_ids[pos]) );
+        }
+        word_positions.resize(write_pos);
+      }
+      // окна ассоциаций: фрагменты хранилища, соответствующие токенам в пределах +-assoc_window от слова,
+      // копируются с устранением повторов (как и множество ассоциаций всего предложения);
+      // при ограничении числа ассоциаций из окна извлекается случайная выборка (частичное перемешивание Фишера-Йетса)
+      auto& assoc_window_offsets = out.assoc_window_offsets;
+      auto& assoc_window_arena = out.assoc_window_arena;
+      assoc_window_offsets.assign(1, 0);
+      assoc_window_arena.clear();
+      if (assoc_window > 0)
+      {
+        for (size_t k = 0; k < word_positions.size(); ++k)
+        {
+          size_t i = word_positions[k];
+          auto lo = std::lower_bound(assoc_positions.begin(), assoc_positions.end(), (i > assoc_window) ? i - assoc_window : 0);
+          auto hi = std::upper_bound(lo, assoc_positions.end(), i + assoc_window);
+          size_t group_begin = assoc_window_arena.size();
+          auto& stamps = t_environment.assoc_stamps;
+          if ( ++t_environment.assoc_stamp == 0 )   // переполнение счётчика: сбрасываем отметки
+          {
+            std::fill(stamps.begin(), stamps.end(), 0);
+            t_environment.assoc_stamp = 1;
+          }
+          uint32_t stamp = t_environment.assoc_stamp;
+          for (auto it = lo; it != hi; ++it)
+          {
+            size_t assoc_idx = assoc_arena[it - assoc_positions.begin()];
+            if ( assoc_idx >= stamps.size() )
+              stamps.resize(assoc_idx + 1, 0);
+            if ( stamps[assoc_idx] == stamp )
+              continue;
+            stamps[assoc_idx] = stamp;
+            assoc_window_arena.push_back(assoc_idx);
+          }
+          size_t group_size = assoc_window_arena.size() - group_begin;
+          if ( assoc_max > 0 && group_size > assoc_max )
+          {
+            t_environment.draw_random16(SAMPLING_STAGE_ASSOC_CAP, assoc_max, static_cast<uint32_t>(k + 1));
+            auto rnd = t_environment.random16.data();
+            auto group = assoc_window_arena.data() + group_begin;
+            for (size_t j = 0; j < assoc_max; ++j)
+              std::swap( group[j], group[ j + ((rnd[j] * (group_size - j)) >> 16) ] );
+            assoc_window_arena.resize(group_begin + assoc_max);
+          }
+          assoc_window_offsets.push_back(assoc_window_arena.size());
+        }
+      }
+      if (assoc_max > 0 && assoc_window == 0)
+        t_environment.draw_random16(SAMPLING_STAGE_ASSOC_CAP, word_positions.size());
+      for (size_t k = 0; k < word_positions.size(); ++k)
+      {
+        size_t i = word_positions[k];
+        LearningExample le;
+        le.word = word_ids[i];
+        le.dep_context = { dep_arena.data() + dep_offsets[i], dep_arena.data() + dep_offsets[i + 1] };
+        le.assoc_context = associations;
+        if (assoc_window > 0)
+          le.assoc_context = { assoc_window_arena.data() + assoc_window_offsets[k], assoc_window_arena.data() + assoc_window_offsets[k + 1] };
+        // ограничение числа ассоциаций в режиме всего предложения: непрерывный фрагмент перемешанного множества длины assoc_max
+        // (окна ассоциаций ограничены выборкой при построении)
+        if ( assoc_max > 0 && le.assoc_context.size() > assoc_max )
+        {
+          size_t shift = (t_environment.random16[k] * (le.assoc_context.size() - assoc_max + 1)) >> 16;
+          le.assoc_context.first += shift;
+          le.assoc_context.last = le.assoc_context.first + assoc_max;
+        }
+        out.examples.push_back(le);
+      }
+      // зерно случайных величин для следующего предложения
+      t_environment.update_random();
+      if ( out.examples.empty() )
+        continue;
+      return true;
+    }
+  } // method-end
+  // захват следующей порции обучающего множества (false -- порции эпохи, а в потоковом режиме -- всех эпох, розданы)
+  bool claim_chunk(size_t threadIndex)
+  {
+    auto& t_environment = thread_environment[threadIndex];
+    size_t chunks_count = chunk_bounds.size() - 1;
+    size_t chunk_idx = 0;
+    if ( streaming )
+    {
+      size_t chunk_no = stream_cursor.fetch_add(1, std::memory_order_relaxed);
+      if ( chunk_no >= stream_total )
+        return false;
+      chunk_idx = chunk_no % chunks_count;
+      t_environment.epoch_no = chunk_no / chunks_count;
+    }
+    else if ( !chunk_scheduler.next(threadIndex, t_environment.epoch_no, chunk_idx) )
+      return false;
+    if ( fseek(t_environment.fi, chunk_bounds[chunk_idx], SEEK_SET) != 0 )
+    {
+      std::cerr << "LearningExampleProvider: chunk seek error: " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    t_environment.chunk_end = chunk_bounds[chunk_idx + 1];
+    return true;
+  } // method-end
+  // построение каталога порций обучающего множества: файл делится на фрагменты около CHUNK_SIZE байт (для небольших файлов -- мельче,
+  // чтобы порций хватило на все потоки), границы которых выровнены на начало предложения (первая строка после пустой строки)
+  bool build_chunk_directory()
+  {
+    if ( !chunk_bounds.empty() )
+      return true;
+    FILE* f = fopen(train_filename.c_str(), "rb");
+    if ( f == nullptr )
+    {
+      std::cerr << "LearningExampleProvider: chunk directory error: " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    chunk_bounds.push_back(0);
+    std::string line;
+    uint64_t chunk_size = std::clamp<uint64_t>(train_file_size / (threads_count * 16), MIN_CHUNK_SIZE, CHUNK_SIZE);
+    for (uint64_t pos = chunk_size; pos < train_file_size; pos += chunk_size)
+    {
+      if ( fseek(f, pos, SEEK_SET) != 0 )
+        break;
+      while (true)
+      {
+        ConllReader::read_line(f, line);
+        if ( feof(f) || line.empty() || line == "\r" )
+          break;
+      }
+      if ( feof(f) )
+        break;
+      uint64_t bound = ftell(f);
+      if ( bound > chunk_bounds.back() && bound < train_file_size )
+        chunk_bounds.push_back(bound);
+    }
+    chunk_bounds.push_back(train_file_size);
+    fclose(f);
+    return true;
+  } // method-end
   // получение размера файла
   uint64_t get_file_size(const std::string& filename)
   {
@@ -1,9 +1,11 @@
 #include "command_line_parameters_defs.h"
 #include "simple_profiler.h"
+#include "conll_generator.h"
 #include "fit_parus.h"
 #include "vocabs_builder.h"
 #include "original_word2vec_vocabulary.h"
 #include "mwe_vocabulary.h"
+#include "mwe_substitution_cache.h"
 #include "learning_example_provider.h"
 #include "trainer.h"
 #include "sim_estimator.h"
@@ -33,6 +35,33 @@ std::shared_ptr<SimilarityEstimator> create_sim_estimator(const CommandLineParam
 }
 
 
+// запуск обучения (в многопоточном или в воспроизводимом режиме)
+void run_training(Trainer& trainer, const CommandLineParametersDefs& cmdLineParams)
+{
+  if ( cmdLineParams.getAsInt("-deterministic") == 1 )
+  {
+    trainer.train_deterministic();
+    return;
+  }
+  // потоковый режим: эпохи не разделяются, порции обучающего множества раздаются потокам динамически
+  bool streaming = ( cmdLineParams.getAsInt("-stream") == 1 );
+  if ( streaming && !trainer.stream_prepare() )
+  {
+    std::cerr << "Stream mode preparation failed, falling back to epoch mode" << std::endl;
+    streaming = false;
+  }
+  // запускаем потоки, осуществляющие обучение
+  size_t threads_count = cmdLineParams.getAsInt("-threads");
+  std::vector<std::thread> threads_vec;
+  threads_vec.reserve(threads_count);
+  for (size_t i = 0; i < threads_count; ++i)
+    threads_vec.emplace_back(streaming ? &Trainer::train_stream_entry_point : &Trainer::train_entry_point, &trainer, i);
+  // ждем завершения обучения
+  for (size_t i = 0; i < threads_count; ++i)
+    threads_vec[i].join();
+}
+
+
 
 int main(int argc, char **argv)
 {
@@ -46,6 +75,7 @@ int main(int argc, char **argv)
   {
     std::cerr << "Task parameter is not defined." << std::endl;
     std::cerr << "Alternatives:" << std::endl
+              << "  -task gen         -- synthetic conll generation (into -fit_input file)" << std::endl
               << "  -task fit         -- conll file transformation" << std::endl
               << "  -task vocab       -- vocabs building" << std::endl
               << "  -task train       -- model training" << std::endl
@@ -62,9 +92,27 @@ int main(int argc, char **argv)
   }
   auto&& task = cmdLineParams.getAsString("-task");
 
+  // если поставлена задача порождения синтетического conll-файла
+  if (task == "gen")
+  {
+    if ( !cmdLineParams.isDefined("-fit_input") )
+    {
+      std::cerr << "-fit_input parameter must be defined." << std::endl;
+      return -1;
+    }
+    SimpleProfiler global_profiler;
+    ConllGenerator generator( std::stoull(cmdLineParams.getAsString("-gen_tokens")),
+                              cmdLineParams.getAsInt("-gen_lemmas"),
+                              cmdLineParams.getAsFloat("-gen_zipf"),
+                              cmdLineParams.getAsFloat("-gen_mwe"),
+                              std::stoull(cmdLineParams.getAsString("-gen_seed")) );
+    return ( generator.run("mwe.list", cmdLineParams.getAsString("-fit_input")) ? 0 : -1 );
+  }
+
   // если поставлена задача преобразования conll-файла
   if (task == "fit")
   {
+    SimpleProfiler global_profiler;
     FitParus fitter;
     fitter.run( cmdLineParams.getAsString("-fit_input"), cmdLineParams.getAsString("-train") );
     return 0;
@@ -73,13 +121,15 @@ int main(int argc, char **argv)
   // если поставлена задача построения словарей
   if (task == "vocab")
   {
+    SimpleProfiler global_profiler;
     VocabsBuilder vb;
     bool succ = vb.build_vocabs( cmdLineParams.getAsString("-train"), "mwe.list",
                                  cmdLineParams.getAsString("-vocab_m"), cmdLineParams.getAsString("-vocab_p"), cmdLineParams.getAsString("-vocab_t"),
                                  cmdLineParams.getAsString("-tl_map"), cmdLineParams.getAsString("-vocab_d"),
                                  cmdLineParams.getAsInt("-min-count_m"), cmdLineParams.getAsInt("-min-count_p"), cmdLineParams.getAsInt("-min-count_t"),
                                  cmdLineParams.getAsInt("-min-count_d"),
-                                 cmdLineParams.getAsInt("-col_ctx_d") - 1, (cmdLineParams.getAsInt("-use_deprel") == 1)
+                                 cmdLineParams.getAsInt("-col_ctx_d") - 1, (cmdLineParams.getAsInt("-use_deprel") == 1),
+                                 (cmdLineParams.getAsInt("-mwe_cache") == 1)
                                );
     return ( succ ? 0 : -1 );
   }
@@ -121,9 +171,34 @@ int main(int argc, char **argv)
       std::cerr << "-vocab_a parameter must be defined." << std::endl;
       return -1;
     }
+    bool incremental = (cmdLineParams.getAsInt("-incremental") == 1);
+    if ( incremental && (!cmdLineParams.isDefined("-vocab_m") || !cmdLineParams.isDefined("-delta_m") || !cmdLineParams.isDefined("-restore")) )
+    {
+      std::cerr << "-vocab_m, -delta_m and -restore parameters must be defined (when -incremental is 1)." << std::endl;
+      return -1;
+    }
+    if ( incremental && cmdLineParams.getAsInt("-size_d") > 0 && !cmdLineParams.isDefined("-delta_d") )
+    {
+      std::cerr << "-delta_d parameter must be defined (when -incremental is 1)." << std::endl;
+      return -1;
+    }
 
     SimpleProfiler global_profiler;
 
+    // при дообучении словари, построенные по новой порции данных, вливаются в накопленные словари
+    auto merge_delta = [&cmdLineParams](std::shared_ptr< OriginalWord2VecVocabulary > vocab, const std::string& deltaParam) -> bool
+                       {
+                         OriginalWord2VecVocabulary delta;
+                         if ( !delta.load( cmdLineParams.getAsString(deltaParam) ) )
+                           return false;
+                         vocab->merge(delta);
+                         return true;
+                       };
+    // новая порция главного словаря загружается однократно: она вливается в главный (и ассоциативный) словарь
+    // и задаёт объём обучения (delta_train_words)
+    OriginalWord2VecVocabulary delta_main;
+    uint64_t delta_train_words = 0;
+
     // загрузка словарей
     bool needLoadMainVocab = cmdLineParams.isDefined("-vocab_m");
     bool needLoadProperVocab = !needLoadMainVocab;
@@ -131,14 +206,29 @@ int main(int argc, char **argv)
     bool needLoadAssocCtxVocab = (cmdLineParams.getAsInt("-size_a") > 0);
     std::shared_ptr< OriginalWord2VecVocabulary > v_main, v_proper, v_dep_ctx, v_assoc_ctx;
     std::shared_ptr< MweVocabulary > v_mwe;
+    std::shared_ptr< MweSubstitutionCache > mwe_cache;
     if (needLoadMainVocab)
     {
       v_main = std::make_shared<OriginalWord2VecVocabulary>();
       if ( !v_main->load( cmdLineParams.getAsString("-vocab_m") ) )
         return -1;
+      if ( incremental )
+      {
+        if ( !delta_main.load( cmdLineParams.getAsString("-delta_m") ) )
+          return -1;
+        v_main->merge(delta_main);
+        delta_train_words = delta_main.cn_sum();
+      }
       v_mwe = std::make_shared<MweVocabulary>( );
       if ( !v_mwe->load("mwe.list", v_main) )
         return -1;
+      // кэш встраивания словосочетаний создаётся при построении словарей (здесь используется только готовый)
+      if ( cmdLineParams.getAsInt("-mwe_cache") == 1 )
+      {
+        mwe_cache = std::make_shared<MweSubstitutionCache>();
+        if ( !mwe_cache->open(cmdLineParams.getAsString("-train"), *v_mwe, false) )
+          mwe_cache.reset();
+      }
     }
     if (needLoadProperVocab)
     {
@@ -151,6 +241,8 @@ int main(int argc, char **argv)
       v_dep_ctx = std::make_shared<OriginalWord2VecVocabulary>();
       if ( !v_dep_ctx->load( cmdLineParams.getAsString("-vocab_d") ) )
         return -1;
+      if ( incremental && !merge_delta(v_dep_ctx, "-delta_d") )
+        return -1;
     }
     if (needLoadAssocCtxVocab)
     {
@@ -158,6 +250,18 @@ int main(int argc, char **argv)
       v_assoc_ctx->init_stoplist("stopwords.assoc");
       if ( !v_assoc_ctx->load( cmdLineParams.getAsString("-vocab_a") ) )
         return -1;
+      // ассоциативный словарь пополняется, если он совпадает с главным (типичная конфигурация)
+      if ( incremental && cmdLineParams.getAsString("-vocab_a") == cmdLineParams.getAsString("-vocab_m") )
+        v_assoc_ctx->merge(delta_main);
+    }
+    // временные словосочетания в модель не записываются (см. сохранение модели ниже), поэтому при обучении собственных имён
+    // их ассоциативные контексты в модели отсутствуют (словосочетания здесь не встраиваются, и такие контексты не встречаются)
+    std::vector<bool> assoc_transient_rows;
+    if ( needLoadProperVocab && v_assoc_ctx )
+    {
+      MweVocabulary assoc_mwe;
+      if ( assoc_mwe.load("mwe.list", v_assoc_ctx) )
+        assoc_mwe.mark_transient_rows(v_assoc_ctx, assoc_transient_rows);
     }
 
     // создание поставщика обучающих примеров
@@ -172,7 +276,12 @@ int main(int argc, char **argv)
                                                                                                   (cmdLineParams.getAsInt("-use_deprel") == 1),
                                                                                                   cmdLineParams.getAsFloat("-sample_w"),
                                                                                                   cmdLineParams.getAsFloat("-sample_d"),
-                                                                                                  cmdLineParams.getAsFloat("-sample_a")
+                                                                                                  cmdLineParams.getAsFloat("-sample_a"),
+                                                                                                  (cmdLineParams.getAsInt("-deterministic") == 1),
+                                                                                                  cmdLineParams.getAsInt("-shuffle"),
+                                                                                                  cmdLineParams.getAsInt("-assoc_window"),
+                                                                                                  cmdLineParams.getAsInt("-assoc_max"),
+                                                                                                  mwe_cache
                                                                                                 );
 
     // создаем объект, организующий обучение
@@ -185,8 +294,24 @@ int main(int argc, char **argv)
                      cmdLineParams.getAsInt("-negative"),
                      cmdLineParams.getAsInt("-threads") );
 
+    // при дообучении проходим только новую порцию данных (а не весь корпус, частоты которого накоплены в словаре)
+    if ( incremental )
+    {
+      lep->set_train_words( delta_train_words );
+      trainer.set_train_words( delta_train_words );
+    }
+
     // инициализация нейросети
-    if (needLoadMainVocab)
+    if (needLoadMainVocab && incremental)
+    {
+      trainer.create_net();
+      trainer.init_net();  // строки новых слов и контекстов инициализируются обычным образом
+      // обе матрицы восстанавливаются из резервной копии: левая матрица сохраняется в ней до свёртывания временных словосочетаний
+      // (векторы в -model уже свёрнуты, и повторное свёртывание при каждом дообучении смещало бы векторы вершин)
+      if ( !trainer.restore( cmdLineParams.getAsString("-restore"), true, true, true ) )
+        return -1;
+    }
+    else if (needLoadMainVocab)
     {
       trainer.create_net();
       trainer.init_net();
@@ -198,38 +323,46 @@ int main(int argc, char **argv)
       VectorsModel vm;
       if ( !vm.load(cmdLineParams.getAsString("-model"), (cmdLineParams.getAsString("-model_fmt") == "txt")) )
         return -1;
-      trainer.restore_assoc_by_model(vm);
+      if ( !trainer.restore_assoc_by_model(vm, assoc_transient_rows.empty() ? nullptr : &assoc_transient_rows) )
+        return -1;
       trainer.restore( cmdLineParams.getAsString("-restore"), false, true );
     }
 
-    // запускаем потоки, осуществляющие обучение
-    size_t threads_count = cmdLineParams.getAsInt("-threads");
-    std::vector<std::thread> threads_vec;
-    threads_vec.reserve(threads_count);
-    for (size_t i = 0; i < threads_count; ++i)
-      threads_vec.emplace_back(&Trainer::train_entry_point, &trainer, i);
-    // ждем завершения обучения
-    for (size_t i = 0; i < threads_count; ++i)
-      threads_vec[i].join();
+    // запускаем обучение
+    run_training(trainer, cmdLineParams);
+    if (v_mwe)
+    {
+      std::cout << std::endl;
+      v_mwe->report_match_stats(std::cout);
+    }
 
     // сохраняем вычисленные вектора в файл
     if (needLoadMainVocab)
     {
+      // резервная копия сохраняет обе матрицы до свёртывания (из неё выполняется дообучение, см. -incremental)
+      if (cmdLineParams.isDefined("-backup"))
+        trainer.backup( cmdLineParams.getAsString("-backup"), true, true );
+      // строки временных словосочетаний, исключаемые из модели
+      std::vector<bool> transient_rows;
       if (v_mwe)
       {
         // вычисление взвешенного среднего между вектором слова и векторами связанных с ним временных словосочетаний (для которых данное слово является синтакс. вершиной)
-        std::vector< std::vector< std::pair<size_t, float> > > collapsing_info;
-        v_mwe->process_transient(v_main, collapsing_info);
-        trainer.vectors_weighted_collapsing(collapsing_info);
-// TODO: сделать удаление временных словосочетаний из модели
-////        size_t transients_count = v_mwe->get_transients_count();
-////        v_main->cut_tail(transients_count); // удаляем вектора временных словосочетаний (они всегда в конце словаря)
-//        // само векторное пространство не урезаем, т.к. при сохранении векторов ориентируемся на размер словаря
+        CollapsingPlan collapsing_plan;
+        v_mwe->process_transient(v_main, collapsing_plan, cmdLineParams.getAsInt("-collapse_log") ? &std::cout : nullptr);
+        trainer.vectors_weighted_collapsing(collapsing_plan);
+        // сами временные словосочетания в модель не записываем (словарь не урезаем, т.к. он сохраняется для дообучения);
+        // их векторы остаются в резервной копии, из которой выполняется дообучение (-incremental)
+        v_mwe->mark_transient_rows(v_main, transient_rows);
       }
       if (cmdLineParams.isDefined("-model"))
-        trainer.saveEmbeddings( cmdLineParams.getAsString("-model"), (cmdLineParams.getAsString("-model_fmt") == "txt") );
-      if (cmdLineParams.isDefined("-backup"))
-        trainer.backup( cmdLineParams.getAsString("-backup"), false, true );
+        trainer.saveEmbeddings( cmdLineParams.getAsString("-model"), (cmdLineParams.getAsString("-model_fmt") == "txt"), v_mwe ? &transient_rows : nullptr );
+      // сохраняем пополненные словари (для следующего дообучения)
+      if ( incremental )
+      {
+        v_main->save( cmdLineParams.getAsString("-vocab_m") );
+        if ( v_dep_ctx )
+          v_dep_ctx->save( cmdLineParams.getAsString("-vocab_d") );
+      }
 //      if ( v_mwe )
 //        v_mwe->dbg_print_meet_counters();
     }
@@ -263,6 +396,7 @@ int main(int argc, char **argv)
   // если поставлена задача самодиагностики (язык: русский)
   if (task == "selftest_ru")
   {
+    SimpleProfiler global_profiler;
     auto sim_estimator = create_sim_estimator(cmdLineParams);
     if (!sim_estimator)
       return -1;
@@ -364,7 +498,11 @@ int main(int argc, char **argv)
                                                                                                   (cmdLineParams.getAsInt("-use_deprel") == 1),
                                                                                                   cmdLineParams.getAsFloat("-sample_w"),
                                                                                                   cmdLineParams.getAsFloat("-sample_d"),
-                                                                                                  cmdLineParams.getAsFloat("-sample_a")
+                                                                                                  cmdLineParams.getAsFloat("-sample_a"),
+                                                                                                  (cmdLineParams.getAsInt("-deterministic") == 1),
+                                                                                                  cmdLineParams.getAsInt("-shuffle"),
+                                                                                                  cmdLineParams.getAsInt("-assoc_window"),
+                                                                                                  cmdLineParams.getAsInt("-assoc_max")
                                                                                                 );
 
     // создаем объект, организующий обучение
@@ -383,15 +521,8 @@ int main(int argc, char **argv)
     trainer.restore_left_matrix_by_model(vm);  // перенос векторых представлений из загруженной модели в левую матрицу
     trainer.restore( cmdLineParams.getAsString("-restore"), false, true );
 
-    // запускаем потоки, осуществляющие обучение
-    size_t threads_count = cmdLineParams.getAsInt("-threads");
-    std::vector<std::thread> threads_vec;
-    threads_vec.reserve(threads_count);
-    for (size_t i = 0; i < threads_count; ++i)
-      threads_vec.emplace_back(&Trainer::train_entry_point, &trainer, i);
-    // ждем завершения обучения
-    for (size_t i = 0; i < threads_count; ++i)
-      threads_vec[i].join();
+    // запускаем обучение
+    run_training(trainer, cmdLineParams);
 
     // сохраняем вычисленные вектора в файл
     trainer.saveEmbeddings( cmdLineParams.getAsString("-model"), (cmdLineParams.getAsString("-model_fmt") == "txt") );
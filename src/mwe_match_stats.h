@@ -0,0 +1,176 @@
+#ifndef MWE_MATCH_STATS_H_
+#define MWE_MATCH_STATS_H_
+
+#include "mwe_pattern_index.h"
+#include "atom_table.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <cstdint>
+
+
+// Статистика сопоставления шаблонов словосочетаний: для каждой фразы подсчитываются попадания в число кандидатов,
+// успешные сопоставления и время, затраченное на сопоставление. Счётчики ведутся каждым потоком управления отдельно
+// (без атомарных операций) в страницах, выделяемых по мере обращения к фразам, поэтому подсчёт не требует синхронизации,
+// а память расходуется только на фразы, действительно встречавшиеся в качестве кандидатов.
+// Кроме того, подсчитывается эффективность предварительного отсева (предложения и кандидаты, отвергнутые до сопоставления).
+// Сводный отчёт (report) формируется после завершения обработки, когда потоки управления уже не обновляют счётчики.
+class MweMatchStats
+{
+public:
+  struct Counters
+  {
+    uint64_t candidates = 0;    // фраза сопоставлялась с предложением (совпала лемма вершины, сигнатура не отвергла)
+    uint64_t matches = 0;       // фраза сопоставлена с предложением
+    uint64_t nanoseconds = 0;   // время сопоставления
+  };
+  struct PrefilterCounters
+  {
+    uint64_t sentences = 0;             // предложения, поступившие на поиск словосочетаний
+    uint64_t rejected_sentences = 0;    // предложения без единой вершины фразы
+    uint64_t rejected_candidates = 0;   // кандидаты, отвергнутые по сигнатуре предложения
+  };
+  MweMatchStats()
+  : id( next_id()++ )
+  {
+  }
+  // сброс статистики (выполняется при загрузке словосочетаний, до начала обработки)
+  void reset()
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    blocks.clear();
+    id = next_id()++;
+  } // method-end
+  // счётчики отсева в блоке текущего потока управления
+  PrefilterCounters& local_prefilter()
+  {
+    return local_block().prefilter;
+  } // method-end
+  // счётчики фразы в блоке текущего потока управления
+  Counters& local(uint32_t phraseIdx)
+  {
+    ThreadBlock* block = &local_block();
+    size_t page_idx = phraseIdx >> PAGE_BITS;
+    if ( page_idx >= block->pages.size() )
+      block->pages.resize(page_idx + 1);
+    auto& page = block->pages[page_idx];
+    if ( !page )
+      page = std::make_unique<Counters[]>(PAGE_SIZE);
+    return page[phraseIdx & (PAGE_SIZE - 1)];
+  } // method-end
+  // вывод сводного отчёта: итоги, самые затратные фразы и самые затратные фразы без единого сопоставления
+  void report(const MwePatternIndex& patterns, std::ostream& os, size_t topCount = 15) const
+  {
+    std::vector<Counters> total( patterns.phrases_count() );
+    PrefilterCounters prefilter;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      for (auto& b : blocks)
+      {
+        prefilter.sentences += b->prefilter.sentences;
+        prefilter.rejected_sentences += b->prefilter.rejected_sentences;
+        prefilter.rejected_candidates += b->prefilter.rejected_candidates;
+        for (size_t p = 0; p < b->pages.size(); ++p)
+        {
+          if ( !b->pages[p] )
+            continue;
+          for (size_t i = 0; i < PAGE_SIZE && (p << PAGE_BITS) + i < total.size(); ++i)
+          {
+            auto& src = b->pages[p][i];
+            auto& dst = total[(p << PAGE_BITS) + i];
+            dst.candidates += src.candidates;
+            dst.matches += src.matches;
+            dst.nanoseconds += src.nanoseconds;
+          }
+        }
+      }
+    }
+    Counters sum;
+    std::vector<uint32_t> used, useless;
+    for (size_t i = 0; i < total.size(); ++i)
+    {
+      sum.candidates += total[i].candidates;
+      sum.matches += total[i].matches;
+      sum.nanoseconds += total[i].nanoseconds;
+      if ( total[i].candidates == 0 )
+        continue;
+      used.push_back(i);
+      if ( total[i].matches == 0 )
+        useless.push_back(i);
+    }
+    if ( prefilter.sentences == 0 )
+      return;
+    auto by_time = [&total](uint32_t a, uint32_t b) { return total[a].nanoseconds > total[b].nanoseconds; };
+    auto flags = os.flags();
+    auto precision = os.precision();
+    os << "MWE matching statistics:" << std::endl;
+    os << "  patterns: " << total.size() << " (token-constrained: " << patterns.token_constrained_count() << ")" << ", candidates: " << used.size() << ", never matched: " << useless.size() << std::endl;
+    os << "  candidate checks: " << sum.candidates << ", matches: " << sum.matches
+       << ", matching time: " << std::fixed << std::setprecision(3) << (sum.nanoseconds / 1e9) << " s" << std::endl;
+    os << "  prefilter: sentences rejected: " << prefilter.rejected_sentences << " of " << prefilter.sentences
+       << " (" << std::setprecision(1) << (100.0 * prefilter.rejected_sentences / prefilter.sentences) << "%)"
+       << ", candidates rejected by signature: " << prefilter.rejected_candidates << std::endl;
+    print_top(patterns, total, used, by_time, topCount, "  most expensive patterns", os);
+    print_top(patterns, total, useless, by_time, topCount, "  most expensive patterns without matches", os);
+    os.flags(flags);
+    os.precision(precision);
+  } // method-end
+private:
+  static constexpr size_t PAGE_BITS = 10;
+  static constexpr size_t PAGE_SIZE = 1 << PAGE_BITS;
+  struct ThreadBlock
+  {
+    std::vector< std::unique_ptr<Counters[]> > pages;
+    PrefilterCounters prefilter;
+  };
+  mutable std::mutex mtx;
+  std::vector< std::unique_ptr<ThreadBlock> > blocks;
+  // идентификатор набора счётчиков (по нему поток управления определяет, что его блок относится к этому набору)
+  uint64_t id;
+
+  // блок счётчиков текущего потока управления (регистрируется при первом обращении)
+  ThreadBlock& local_block()
+  {
+    thread_local uint64_t owner_id = 0;
+    thread_local ThreadBlock* block = nullptr;
+    if ( owner_id != id )
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      blocks.emplace_back( std::make_unique<ThreadBlock>() );
+      block = blocks.back().get();
+      owner_id = id;
+    }
+    return *block;
+  } // method-end
+  static std::atomic<uint64_t>& next_id()
+  {
+    static std::atomic<uint64_t> counter{1};
+    return counter;
+  } // method-end
+  template<typename Compare>
+  static void print_top( const MwePatternIndex& patterns, const std::vector<Counters>& total, std::vector<uint32_t>& idxs,
+                         Compare cmp, size_t topCount, const char* title, std::ostream& os )
+  {
+    if ( idxs.empty() )
+      return;
+    size_t n = std::min(topCount, idxs.size());
+    std::partial_sort(idxs.begin(), idxs.begin() + n, idxs.end(), cmp);
+    auto& atom_table = AtomTable::global();
+    os << title << " (time ms / candidates / matches):" << std::endl;
+    for (size_t i = 0; i < n; ++i)
+    {
+      auto& c = total[ idxs[i] ];
+      os << "    " << atom_table.str( patterns.phrase(idxs[i]).descr_atom ) << "\t"
+         << std::fixed << std::setprecision(3) << (c.nanoseconds / 1e6) << "\t" << c.candidates << "\t" << c.matches << std::endl;
+    }
+  } // method-end
+}; // class-decl-end
+
+
+#endif /* MWE_MATCH_STATS_H_ */
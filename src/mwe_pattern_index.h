@@ -0,0 +1,687 @@
+#ifndef MWE_PATTERN_INDEX_H_
+#define MWE_PATTERN_INDEX_H_
+
+#include "conll_sentence.h"
+#include "atom_table.h"
+#include "sidecar_file.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <limits>
+#include <algorithm>
+#include <memory_resource>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+
+// Скомпилированный индекс шаблонов словосочетаний.
+// Деревья словосочетаний хранятся в плоских массивах (узлы ссылаются друг на друга индексами, слова представлены атомами,
+// а колонка conll, по которой сопоставляется узел -- токен или лемма, -- указывается в самом узле),
+// а фразы сгруппированы по атомам вершин (CSR-таблица). Сопоставление выполняется над целочисленными
+// синтаксическими массивами предложения без обращения к строкам и без выделения памяти вне арены предложения.
+// Индекс может быть сохранён в двоичный кэш (save_cache) и загружен из него отображением файла в память (load_cache),
+// что избавляет от разбора текстового списка словосочетаний. Атомы локальны для процесса, поэтому в кэше слова
+// хранятся пулом строк, а узлы и фразы ссылаются на номера строк пула; при загрузке строки интернируются однократно.
+// Перед сопоставлением выполняется отсев: предложение отвергается, если ни одна его лемма (а при наличии вершин,
+// сопоставляемых по токену, -- и ни один токен) не является вершиной фразы (битовая карта атомов вершин), а фраза -- если слова ни одного из её деревьев не входят в сигнатуру предложения
+// (фильтр Блума над атомами лемм и токенов). Сигнатуры зависят от нумерации атомов и строятся при каждой загрузке.
+class MwePatternIndex
+{
+public:
+  static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+  // колонки conll, по которым сопоставляются узлы шаблонов (токен и лемма)
+  static constexpr uint8_t FORM_COLUMN = 1;
+  static constexpr uint8_t LEMMA_COLUMN = 2;
+  // узел шаблона
+  struct Node
+  {
+    uint32_t atom;              // атом слова
+    uint32_t head;              // синтаксический предок (NONE, если нет)
+    uint32_t children_begin;    // диапазон потомков в массиве children
+    uint32_t children_end;
+    uint8_t column;             // колонка conll, с атомом которой сравнивается слово узла (FORM_COLUMN или LEMMA_COLUMN)
+    uint8_t out_of_match;       // узел служит только для распознавания и не подлежит замещению
+  };
+  // фраза (лексикализованное словосочетание или значение маркированной вершины)
+  struct Phrase
+  {
+    uint32_t descr_atom;        // атом дескриптора
+    uint32_t head_atom;         // атом леммы маркированной вершины
+    uint32_t roots_begin;       // диапазон вариантов (корней деревьев) в массиве roots
+    uint32_t roots_end;
+  };
+  // элемент очереди восстановления сопоставления: <токен предложения, сопоставленный ему узел шаблона>
+  struct Query
+  {
+    uint32_t token;
+    uint32_t node;
+  };
+  // рабочие структуры сопоставления (размещаются в арене предложения)
+  struct MatchScratch
+  {
+    std::pmr::vector<Query> queue;
+    // битовые множества токенов по узлам шаблона: пары (узел, токен), для которых выполнимость уже вычислена, и выполнимые пары
+    std::pmr::vector<uint64_t> memo;
+    size_t words = 0;
+    // распределение токенов между потомками узла шаблона: рабочие массивы уровней рекурсии и итоговое распределение
+    std::pmr::vector<uint32_t> stack;
+    std::pmr::vector<uint32_t> assigned;
+    explicit MatchScratch(std::pmr::memory_resource* mr)
+    : queue(mr)
+    , memo(mr)
+    , stack(mr)
+    , assigned(mr)
+    {
+    }
+  };
+  // сигнатура множества атомов (фильтр Блума, по одному биту на атом)
+  static constexpr size_t SIGNATURE_WORDS = 2;
+  struct Signature
+  {
+    uint64_t bits[SIGNATURE_WORDS] = {0};
+    inline void add(uint32_t atom)
+    {
+      uint32_t bit = static_cast<uint32_t>((atom * 0x9E3779B97F4A7C15ULL) >> 57);   // 7 старших бит -- номер бита из 128
+      bits[bit >> 6] |= 1ULL << (bit & 63);
+    }
+    inline bool contains(const Signature& other) const
+    {
+      for (size_t w = 0; w < SIGNATURE_WORDS; ++w)
+        if ( other.bits[w] & ~bits[w] )
+          return false;
+      return true;
+    }
+  };
+  // синтаксические потомки токенов предложения (CSR): потомки токена i -- child_list[child_offsets[i] .. child_offsets[i+1])
+  struct SentenceDeps
+  {
+    std::pmr::vector<uint32_t> child_offsets;
+    std::pmr::vector<uint32_t> child_list;
+    explicit SentenceDeps(std::pmr::memory_resource* mr)
+    : child_offsets(mr)
+    , child_list(mr)
+    {
+    }
+  };
+
+  // построение индекса по словосочетаниям, проиндексированным леммами вершин
+  // (порядок фраз с общей вершиной сохраняется)
+  template<typename PhraseMap>
+  void build(const PhraseMap& mwes)
+  {
+    auto& atom_table = AtomTable::global();
+    nodes.clear();
+    children.clear();
+    roots.clear();
+    phrases.clear();
+    max_pattern_size = 0;
+    for (auto& mwe : mwes)
+    {
+      auto& phrase = mwe.second;
+      Phrase entry;
+      entry.descr_atom = atom_table.intern(phrase->str);
+      entry.roots_begin = roots.size();
+      for (auto& t : phrase->trees)
+      {
+        size_t nodes_before = nodes.size();
+        roots.push_back( add_tree(*t) );
+        max_pattern_size = std::max(max_pattern_size, nodes.size() - nodes_before);
+      }
+      entry.roots_end = roots.size();
+      entry.head_atom = atom_table.intern(mwe.first);
+      phrases.push_back(entry);
+    }
+    build_lookup_tables();
+  } // method-end
+  // оставление в индексе только фраз, дескрипторы которых удовлетворяют предикату (порядок фраз сохраняется)
+  // узлы отброшенных фраз остаются в хранилище, но становятся недостижимы
+  template<typename Predicate>
+  void retain_phrases(Predicate pred)
+  {
+    phrases.erase( std::remove_if(phrases.begin(), phrases.end(), [&](const Phrase& ph) { return !pred(ph.descr_atom); }), phrases.end() );
+    build_lookup_tables();
+  } // method-end
+  // сигнатура предложения (атомы лемм и токенов); false -- ни одна лемма не является вершиной фразы, предложение можно не рассматривать
+  bool sentence_signature(const ConllSentence& sentence, Signature& signature) const
+  {
+    bool has_head = false;
+    for (size_t i = 0; i < sentence.size(); ++i)
+    {
+      uint32_t lemma = sentence.atom(i, LEMMA_COLUMN);
+      uint32_t form = sentence.atom(i, FORM_COLUMN);
+      has_head |= is_head(lemma) || (token_heads && is_head(form));
+      signature.add(lemma);
+      signature.add(form);
+    }
+    return has_head;
+  } // method-end
+  // признак вершины фразы
+  inline bool is_head(uint32_t atom) const
+  {
+    size_t w = atom >> 6;
+    return w < head_bitmap.size() && (head_bitmap[w] & (1ULL << (atom & 63)));
+  } // method-end
+  // возможность сопоставления фразы с предложением: слова хотя бы одного из деревьев входят в сигнатуру предложения
+  inline bool may_match(uint32_t phraseIdx, const Signature& sentenceSignature) const
+  {
+    auto& ph = phrases[phraseIdx];
+    for (uint32_t r = ph.roots_begin; r < ph.roots_end; ++r)
+      if ( sentenceSignature.contains(root_signatures[r]) )
+        return true;
+    return false;
+  } // method-end
+  // диапазон фраз (в массиве head_phrases), вершина которых имеет заданный атом
+  inline std::pair<const uint32_t*, const uint32_t*> phrases_for(uint32_t headAtom) const
+  {
+    if ( head_offsets.empty() || headAtom >= head_offsets.size() - 1 )
+      return {nullptr, nullptr};
+    return { head_phrases.data() + head_offsets[headAtom], head_phrases.data() + head_offsets[headAtom + 1] };
+  } // method-end
+  const Phrase& phrase(uint32_t idx) const
+  {
+    return phrases[idx];
+  } // method-end
+  size_t phrases_count() const
+  {
+    return phrases.size();
+  } // method-end
+  bool empty() const
+  {
+    return phrases.empty();
+  } // method-end
+  // признак наличия фраз, маркированная вершина которых сопоставляется по токену (такие фразы ищутся и по атомам токенов)
+  bool has_token_heads() const
+  {
+    return token_heads;
+  } // method-end
+  // количество фраз, в деревьях которых есть узлы, сопоставляемые по токену
+  size_t token_constrained_count() const
+  {
+    return token_constrained;
+  } // method-end
+  // признак временного словосочетания: маркированная вершина первого варианта фразы не подлежит замещению
+  bool is_transient(uint32_t idx) const
+  {
+    auto& ph = phrases[idx];
+    return ph.roots_begin < ph.roots_end && nodes[ roots[ph.roots_begin] ].out_of_match;
+  } // method-end
+  // наибольшее количество узлов в одном дереве (для резервирования памяти под очередь и результат сопоставления)
+  size_t max_nodes() const
+  {
+    return max_pattern_size;
+  } // method-end
+  // отпечаток содержимого индекса (фразы и деревья в порядке их следования; не зависит от нумерации атомов)
+  // совпадение отпечатков означает, что сопоставление с любым предложением даст одинаковый результат
+  uint64_t fingerprint() const
+  {
+    auto& atom_table = AtomTable::global();
+    uint64_t h = FNV_OFFSET;
+    for (auto& ph : phrases)
+    {
+      h = hash_string(h, atom_table.str(ph.descr_atom));
+      h = hash_string(h, atom_table.str(ph.head_atom));
+      h = hash_value(h, ph.roots_end - ph.roots_begin);
+      for (uint32_t r = ph.roots_begin; r < ph.roots_end; ++r)
+        h = hash_tree(h, roots[r]);
+    }
+    // фразы с вершинами, сопоставляемыми по токену, ищутся и по атомам токенов
+    if ( token_heads )
+      h = hash_value(h, FORM_COLUMN);
+    return h;
+  } // method-end
+  // сохранение индекса в двоичный кэш (запись во временный файл с последующим переименованием)
+  bool save_cache(const std::string& fn, const SidecarFile::SourceStamp& stamp) const
+  {
+    auto& atom_table = AtomTable::global();
+    // пул строк: атомы, на которые ссылаются узлы и фразы, заменяются номерами строк пула
+    std::unordered_map<uint32_t, uint32_t> local_ids;
+    std::vector<uint32_t> pool;
+    auto local = [&](uint32_t atom) -> uint32_t
+                 {
+                   auto res = local_ids.emplace(atom, pool.size());
+                   if ( res.second )
+                     pool.push_back(atom);
+                   return res.first->second;
+                 };
+    std::vector<Node> cache_nodes(nodes);
+    for (auto& n : cache_nodes)
+      n.atom = local(n.atom);
+    std::vector<Phrase> cache_phrases(phrases);
+    for (auto& ph : cache_phrases)
+    {
+      ph.descr_atom = local(ph.descr_atom);
+      ph.head_atom = local(ph.head_atom);
+    }
+    std::vector<uint64_t> string_offsets(pool.size() + 1, 0);
+    std::string string_bytes;
+    for (size_t i = 0; i < pool.size(); ++i)
+    {
+      string_bytes += atom_table.str(pool[i]);
+      string_offsets[i + 1] = string_bytes.size();
+    }
+
+    CacheHeader hdr;
+    std::memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = CACHE_VERSION;
+    hdr.source = stamp;
+    hdr.strings_count = pool.size();
+    hdr.string_bytes = string_bytes.size();
+    hdr.nodes_count = cache_nodes.size();
+    hdr.children_count = children.size();
+    hdr.roots_count = roots.size();
+    hdr.phrases_count = cache_phrases.size();
+    hdr.max_pattern_size = max_pattern_size;
+
+    std::string tmp_fn = SidecarFile::temp_filename(fn);
+    FILE* f = fopen(tmp_fn.c_str(), "wb");
+    if ( !f )
+      return false;
+    bool ok = SidecarFile::write_section(f, &hdr, sizeof(hdr))
+              && SidecarFile::write_section(f, string_offsets.data(), string_offsets.size() * sizeof(uint64_t))
+              && SidecarFile::write_section(f, string_bytes.data(), string_bytes.size())
+              && SidecarFile::write_section(f, cache_nodes.data(), cache_nodes.size() * sizeof(Node))
+              && SidecarFile::write_section(f, children.data(), children.size() * sizeof(uint32_t))
+              && SidecarFile::write_section(f, roots.data(), roots.size() * sizeof(uint32_t))
+              && SidecarFile::write_section(f, cache_phrases.data(), cache_phrases.size() * sizeof(Phrase));
+    ok = (fclose(f) == 0) && ok;
+    if ( !ok || rename(tmp_fn.c_str(), fn.c_str()) != 0 )
+    {
+      remove(tmp_fn.c_str());
+      return false;
+    }
+    return true;
+  } // method-end
+  // загрузка индекса из двоичного кэша (false, если кэша нет, он повреждён или построен по другой версии списка)
+  bool load_cache(const std::string& fn, const SidecarFile::SourceStamp& stamp)
+  {
+    size_t file_size = 0;
+    const char* base = SidecarFile::map(fn, sizeof(CacheHeader), file_size);
+    if ( !base )
+      return false;
+    bool ok = load_mapped(base, file_size, stamp);
+    SidecarFile::unmap(base, file_size);
+    if ( !ok )
+    {
+      nodes.clear();
+      children.clear();
+      roots.clear();
+      phrases.clear();
+      max_pattern_size = 0;
+      build_lookup_tables();
+    }
+    return ok;
+  } // method-end
+  // построение списков синтаксических потомков токенов (false, если колонка HEAD некорректна)
+  static bool build_deps(const ConllSentence& sentence, SentenceDeps& deps)
+  {
+    if ( !sentence.all_heads_valid() )
+      return false;
+    size_t n = sentence.size();
+    deps.child_offsets.assign(n + 1, 0);
+    deps.child_list.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+      int h = sentence.head(i);
+      if ( h >= 1 && static_cast<size_t>(h) <= n )
+        ++deps.child_offsets[h];
+    }
+    for (size_t i = 0; i < n; ++i)
+      deps.child_offsets[i + 1] += deps.child_offsets[i];
+    for (size_t i = 0; i < n; ++i)   // заполняем в порядке следования токенов
+    {
+      int h = sentence.head(i);
+      if ( h >= 1 && static_cast<size_t>(h) <= n )
+        deps.child_list[ deps.child_offsets[h - 1]++ ] = i;
+    }
+    for (size_t i = n; i > 0; --i)   // после заполнения смещения сдвинуты на одну группу вперёд
+      deps.child_offsets[i] = deps.child_offsets[i - 1];
+    deps.child_offsets[0] = 0;
+    return true;
+  } // method-end
+  // сопоставление одного из вариантов фразы с поддеревом предложения, маркированная вершина которого -- matchPoint
+  // в случае успеха match содержит упорядоченные индексы замещаемых токенов
+  bool match_phrase( const ConllSentence& sentence, const SentenceDeps& deps, size_t matchPoint, uint32_t phraseIdx,
+                     MatchScratch& scratch, std::pmr::vector<uint32_t>& match ) const
+  {
+    auto& ph = phrases[phraseIdx];
+    for (uint32_t r = ph.roots_begin; r < ph.roots_end; ++r)
+      if ( match_tree(sentence, deps, matchPoint, roots[r], scratch, match) )
+        return true;
+    return false;
+  } // method-end
+private:
+  std::vector<Node> nodes;
+  std::vector<uint32_t> children;
+  std::vector<uint32_t> roots;
+  std::vector<Phrase> phrases;
+  // фразы, сгруппированные по атомам вершин: фразы вершины a -- head_phrases[head_offsets[a] .. head_offsets[a+1])
+  std::vector<uint32_t> head_offsets;
+  std::vector<uint32_t> head_phrases;
+  // битовая карта атомов вершин фраз
+  std::vector<uint64_t> head_bitmap;
+  // сигнатуры деревьев (по индексам массива roots): атомы всех узлов, кроме маркированной вершины
+  std::vector<Signature> root_signatures;
+  // наличие вершин, сопоставляемых по токену, и количество фраз с узлами, сопоставляемыми по токену
+  bool token_heads = false;
+  size_t token_constrained = 0;
+  size_t max_pattern_size = 0;
+
+  // заголовок двоичного кэша; за ним следуют секции, каждая выровнена на 8 байт:
+  // смещения строк пула (strings_count + 1), байты строк пула, узлы, потомки, корни, фразы
+  static constexpr char CACHE_MAGIC[8] = {'M', 'W', 'E', 'I', 'D', 'X', 0, 0};
+  static constexpr uint32_t CACHE_VERSION = 2;
+  struct CacheHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved = 0;
+    SidecarFile::SourceStamp source;
+    uint64_t strings_count;
+    uint64_t string_bytes;
+    uint64_t nodes_count;
+    uint64_t children_count;
+    uint64_t roots_count;
+    uint64_t phrases_count;
+    uint64_t max_pattern_size;
+  };
+
+  // хэширование FNV-1a
+  static constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+  static constexpr uint64_t FNV_PRIME = 0x100000001b3ULL;
+  static inline uint64_t hash_value(uint64_t h, uint64_t value)
+  {
+    for (size_t i = 0; i < sizeof(value); ++i, value >>= 8)
+      h = (h ^ (value & 0xFF)) * FNV_PRIME;
+    return h;
+  } // method-end
+  static inline uint64_t hash_string(uint64_t h, const std::string& str)
+  {
+    for (unsigned char c : str)
+      h = (h ^ c) * FNV_PRIME;
+    return hash_value(h, str.size());
+  } // method-end
+  uint64_t hash_tree(uint64_t h, uint32_t nodeIdx) const
+  {
+    const Node& node = nodes[nodeIdx];
+    h = hash_string(h, AtomTable::global().str(node.atom));
+    h = hash_value(h, (node.column == FORM_COLUMN ? 1 : 0) | (node.out_of_match ? 2 : 0) | (node.head != NONE ? 4 : 0));
+    if ( node.head != NONE )
+      h = hash_tree(h, node.head);
+    h = hash_value(h, node.children_end - node.children_begin);
+    for (uint32_t k = node.children_begin; k < node.children_end; ++k)
+      h = hash_tree(h, children[k]);
+    return h;
+  } // method-end
+  // построение таблиц поиска: группировка фраз по атомам вершин (устойчивая сортировка подсчётом),
+  // битовая карта вершин, сигнатуры деревьев и сведения об узлах, сопоставляемых по токену
+  void build_lookup_tables()
+  {
+    uint32_t atoms_count = 0;
+    for (auto& ph : phrases)
+      atoms_count = std::max(atoms_count, ph.head_atom + 1);
+    head_offsets.assign(atoms_count + 1, 0);
+    for (auto& ph : phrases)
+      ++head_offsets[ph.head_atom + 1];
+    for (size_t a = 0; a < atoms_count; ++a)
+      head_offsets[a + 1] += head_offsets[a];
+    head_phrases.resize(phrases.size());
+    std::vector<uint32_t> fill(head_offsets.begin(), head_offsets.end() - 1);
+    for (size_t i = 0; i < phrases.size(); ++i)
+      head_phrases[ fill[phrases[i].head_atom]++ ] = i;
+    head_bitmap.assign((atoms_count + 63) / 64, 0);
+    for (auto& ph : phrases)
+      head_bitmap[ph.head_atom >> 6] |= 1ULL << (ph.head_atom & 63);
+    root_signatures.assign(roots.size(), Signature());
+    std::vector<uint8_t> root_token_constrained(roots.size(), 0);
+    for (size_t r = 0; r < roots.size(); ++r)
+      root_token_constrained[r] = add_tree_signature(root_signatures[r], roots[r], true);
+    token_heads = false;
+    token_constrained = 0;
+    for (auto& ph : phrases)
+    {
+      bool constrained = false;
+      for (uint32_t r = ph.roots_begin; r < ph.roots_end; ++r)
+      {
+        token_heads |= (nodes[ roots[r] ].column == FORM_COLUMN);
+        constrained |= (root_token_constrained[r] != 0);
+      }
+      if (constrained)
+        ++token_constrained;
+    }
+  } // method-end
+  // добавление атомов дерева в сигнатуру (true -- в дереве есть узлы, сопоставляемые по токену)
+  bool add_tree_signature(Signature& signature, uint32_t nodeIdx, bool isRoot) const
+  {
+    const Node& node = nodes[nodeIdx];
+    bool token_constrained = (node.column == FORM_COLUMN);
+    if ( !isRoot )
+      signature.add(node.atom);
+    if ( node.head != NONE )
+      token_constrained |= add_tree_signature(signature, node.head, false);
+    for (uint32_t k = node.children_begin; k < node.children_end; ++k)
+      token_constrained |= add_tree_signature(signature, children[k], false);
+    return token_constrained;
+  } // method-end
+  bool load_mapped(const char* base, size_t fileSize, const SidecarFile::SourceStamp& stamp)
+  {
+    CacheHeader hdr;
+    std::memcpy(&hdr, base, sizeof(hdr));
+    if ( std::memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != CACHE_VERSION )
+      return false;
+    if ( !(hdr.source == stamp) )
+      return false;
+    size_t offset = sizeof(CacheHeader);
+    auto string_offsets = SidecarFile::map_section<uint64_t>(base, fileSize, offset, hdr.strings_count + 1);
+    auto string_bytes = SidecarFile::map_section<char>(base, fileSize, offset, hdr.string_bytes);
+    auto cache_nodes = SidecarFile::map_section<Node>(base, fileSize, offset, hdr.nodes_count);
+    auto cache_children = SidecarFile::map_section<uint32_t>(base, fileSize, offset, hdr.children_count);
+    auto cache_roots = SidecarFile::map_section<uint32_t>(base, fileSize, offset, hdr.roots_count);
+    auto cache_phrases = SidecarFile::map_section<Phrase>(base, fileSize, offset, hdr.phrases_count);
+    if ( !string_offsets || !string_bytes || !cache_nodes || !cache_children || !cache_roots || !cache_phrases )
+      return false;
+    // интернируем пул строк
+    auto& atom_table = AtomTable::global();
+    std::vector<uint32_t> atoms(hdr.strings_count);
+    for (size_t i = 0; i < hdr.strings_count; ++i)
+    {
+      if ( string_offsets[i] > string_offsets[i + 1] || string_offsets[i + 1] > hdr.string_bytes )
+        return false;
+      atoms[i] = atom_table.intern( std::string_view(string_bytes + string_offsets[i], string_offsets[i + 1] - string_offsets[i]) );
+    }
+    // копируем плоские массивы, заменяя номера строк пула атомами (с контролем ссылок)
+    auto valid_node = [&](uint32_t n) { return n < hdr.nodes_count; };
+    nodes.assign(cache_nodes, cache_nodes + hdr.nodes_count);
+    for (auto& n : nodes)
+    {
+      if ( n.atom >= hdr.strings_count || (n.head != NONE && !valid_node(n.head))
+           || n.children_begin > n.children_end || n.children_end > hdr.children_count )
+        return false;
+      n.atom = atoms[n.atom];
+    }
+    children.assign(cache_children, cache_children + hdr.children_count);
+    roots.assign(cache_roots, cache_roots + hdr.roots_count);
+    if ( !std::all_of(children.begin(), children.end(), valid_node) || !std::all_of(roots.begin(), roots.end(), valid_node) )
+      return false;
+    phrases.assign(cache_phrases, cache_phrases + hdr.phrases_count);
+    for (auto& ph : phrases)
+    {
+      if ( ph.descr_atom >= hdr.strings_count || ph.head_atom >= hdr.strings_count
+           || ph.roots_begin > ph.roots_end || ph.roots_end > hdr.roots_count )
+        return false;
+      ph.descr_atom = atoms[ph.descr_atom];
+      ph.head_atom = atoms[ph.head_atom];
+    }
+    max_pattern_size = hdr.max_pattern_size;
+    build_lookup_tables();
+    return true;
+  } // method-end
+
+  // добавление дерева в плоское хранилище (возвращает индекс узла)
+  template<typename TreeNodeT>
+  uint32_t add_tree(const TreeNodeT& node)
+  {
+    uint32_t id = nodes.size();
+    nodes.push_back( Node{ AtomTable::global().intern(node.word), NONE, 0, 0, (node.tok_match ? FORM_COLUMN : LEMMA_COLUMN), node.out_of_match } );
+    uint32_t first_child = children.size();
+    children.resize(first_child + node.children.size());
+    nodes[id].children_begin = first_child;
+    nodes[id].children_end = children.size();
+    if ( node.head )
+    {
+      uint32_t head_id = add_tree(*node.head);
+      nodes[id].head = head_id;
+    }
+    for (size_t k = 0; k < node.children.size(); ++k)
+    {
+      uint32_t child_id = add_tree(*node.children[k]);
+      children[first_child + k] = child_id;
+    }
+    return id;
+  } // method-end
+  // сопоставление дерева с поддеревом предложения, маркированная вершина которого -- matchPoint
+  // Сопоставление полное (не жадное): для каждого узла шаблона рассматриваются все подходящие токены (во фразе
+  // "друг пригласил друга на чай" для [пригласить[друг[на]]] будет найден второй из потомков "друг"). Перебора
+  // с возвратами нет: выполнимость пары (узел шаблона, токен) вычисляется однократно и запоминается в битовых множествах,
+  // а различные токены между потомками узла шаблона распределяются поиском увеличивающих цепей (Кун).
+  // Выполнимость вычисляется лениво, в порядке следования токенов, поэтому в типичном случае (первый же подходящий токен
+  // годится) объём работы тот же, что и у жадного сопоставления.
+  bool match_tree( const ConllSentence& sentence, const SentenceDeps& deps, size_t matchPoint, uint32_t root,
+                   MatchScratch& scratch, std::pmr::vector<uint32_t>& match ) const
+  {
+    match.clear();
+    // кандидаты отбираются по атому леммы или токена, поэтому вершину шаблона сверяем по её собственной колонке
+    // (иначе вершина, сопоставляемая по токену, найдётся и по совпавшей с ним лемме, и наоборот)
+    if ( sentence.atom(matchPoint, nodes[root].column) != nodes[root].atom )
+      return false;
+    scratch.words = (sentence.size() + 63) / 64;
+    scratch.memo.clear();   // битовые множества заводятся при первом обращении к ним (листьям шаблона они не нужны)
+    scratch.stack.clear();
+    if ( !check_node(sentence, deps, root, root, matchPoint, scratch) )
+      return false;
+    // восстанавливаем сопоставление обходом в ширину от маркированной вершины (выполнимость всех нужных пар уже известна)
+    auto& queue = scratch.queue;
+    queue.clear();
+    queue.push_back( Query{static_cast<uint32_t>(matchPoint), root} );
+    for (size_t qi = 0; qi < queue.size(); ++qi)
+    {
+      Query q = queue[qi];
+      const Node& node = nodes[q.node];
+      if ( !node.out_of_match )
+        match.push_back(q.token);
+      if ( node.head != NONE )
+        queue.push_back( Query{static_cast<uint32_t>(sentence.head(q.token) - 1), node.head} );
+      if ( node.children_begin == node.children_end )
+        continue;
+      assign_children(sentence, deps, root, q.node, q.token, scratch);
+      for (uint32_t k = node.children_begin; k < node.children_end; ++k)
+        queue.push_back( Query{scratch.assigned[k - node.children_begin], children[k]} );
+    }
+    std::sort(match.begin(), match.end());
+    match.erase( std::unique(match.begin(), match.end()), match.end() );
+    return true;
+  } // method-end
+  // выполнимость сопоставления узла шаблона (вместе с его поддеревом) токену предложения
+  // (для внутренних узлов результат запоминается)
+  bool feasible( const ConllSentence& sentence, const SentenceDeps& deps, uint32_t root, uint32_t nodeIdx, uint32_t token,
+                 MatchScratch& scratch ) const
+  {
+    const Node& node = nodes[nodeIdx];
+    if ( sentence.atom(token, node.column) != node.atom )
+      return false;
+    if ( node.head == NONE && node.children_begin == node.children_end )
+      return true;
+    // узлы дерева шаблона занимают непрерывный диапазон, начинающийся с корня
+    size_t local = nodeIdx - root;
+    if ( local >= max_pattern_size )
+      return false;
+    if ( scratch.memo.empty() )
+      scratch.memo.assign(2 * max_pattern_size * scratch.words, 0);
+    size_t w = local * 2 * scratch.words + token / 64;
+    uint64_t bit = 1ULL << (token % 64);
+    if ( scratch.memo[w] & bit )
+      return scratch.memo[w + scratch.words] & bit;
+    bool result = check_node(sentence, deps, root, nodeIdx, token, scratch);
+    scratch.memo[w] |= bit;
+    if ( result )
+      scratch.memo[w + scratch.words] |= bit;
+    return result;
+  } // method-end
+  // выполнимость окрестности узла шаблона (предок и потомки), сопоставленного токену
+  bool check_node( const ConllSentence& sentence, const SentenceDeps& deps, uint32_t root, uint32_t nodeIdx, uint32_t token,
+                   MatchScratch& scratch ) const
+  {
+    const Node& node = nodes[nodeIdx];
+    if ( node.head != NONE )
+    {
+      int syn_head = sentence.head(token) - 1;
+      if ( syn_head < 0 || static_cast<size_t>(syn_head) >= sentence.size() || !feasible(sentence, deps, root, node.head, syn_head, scratch) )
+        return false;
+    }
+    return node.children_begin == node.children_end || assign_children(sentence, deps, root, nodeIdx, token, scratch);
+  } // method-end
+  // распределение различных синтаксических потомков токена между потомками узла шаблона
+  // (в случае успеха scratch.assigned содержит токены, сопоставленные потомкам узла)
+  // рабочие массивы уровня (владельцы и отметки посещения потомков токена) размещаются на стеке scratch.stack поверх
+  // массивов вызвавших уровней: вычисление выполнимости потомков может рекурсивно распределять потомков более глубоких узлов
+  bool assign_children( const ConllSentence& sentence, const SentenceDeps& deps, uint32_t root, uint32_t nodeIdx, uint32_t token,
+                        MatchScratch& scratch ) const
+  {
+    const Node& node = nodes[nodeIdx];
+    uint32_t k = node.children_end - node.children_begin;
+    uint32_t s_begin = deps.child_offsets[token];
+    uint32_t s_count = deps.child_offsets[token + 1] - s_begin;
+    if ( k > s_count )
+      return false;
+    AssignLevel level{ nodeIdx, s_begin, s_count, static_cast<uint32_t>(scratch.stack.size()) };
+    scratch.stack.resize(level.base + 2 * s_count);
+    std::fill(scratch.stack.begin() + level.base, scratch.stack.begin() + level.base + s_count, NONE);  // владельцы
+    bool result = true;
+    for (uint32_t c = 0; c < k && result; ++c)
+    {
+      std::fill(scratch.stack.begin() + level.base + s_count, scratch.stack.end(), 0);  // отметки посещения
+      result = augment(sentence, deps, root, level, c, scratch);
+    }
+    if ( result )
+    {
+      scratch.assigned.assign(k, NONE);
+      for (uint32_t s = 0; s < s_count; ++s)
+        if ( scratch.stack[level.base + s] != NONE )
+          scratch.assigned[ scratch.stack[level.base + s] ] = deps.child_list[s_begin + s];
+    }
+    scratch.stack.resize(level.base);
+    return result;
+  } // method-end
+  struct AssignLevel
+  {
+    uint32_t node;
+    uint32_t s_begin;
+    uint32_t s_count;
+    uint32_t base;
+  };
+  // поиск увеличивающей цепи для c-го потомка узла шаблона
+  bool augment( const ConllSentence& sentence, const SentenceDeps& deps, uint32_t root, const AssignLevel& level, uint32_t c,
+                MatchScratch& scratch ) const
+  {
+    uint32_t child = children[ nodes[level.node].children_begin + c ];
+    for (uint32_t s = 0; s < level.s_count; ++s)
+    {
+      if ( scratch.stack[level.base + level.s_count + s] )
+        continue;
+      if ( !feasible(sentence, deps, root, child, deps.child_list[level.s_begin + s], scratch) )
+        continue;
+      scratch.stack[level.base + level.s_count + s] = 1;
+      uint32_t owner = scratch.stack[level.base + s];
+      if ( owner == NONE || augment(sentence, deps, root, level, owner, scratch) )
+      {
+        scratch.stack[level.base + s] = c;
+        return true;
+      }
+    }
+    return false;
+  } // method-end
+}; // class-decl-end
+
+
+#endif /* MWE_PATTERN_INDEX_H_ */
@@ -0,0 +1,334 @@
+#ifndef MWE_SUBSTITUTION_CACHE_H_
+#define MWE_SUBSTITUTION_CACHE_H_
+
+#include "mwe_vocabulary.h"
+#include "mwe_pattern_index.h"
+#include "conll_sentence.h"
+#include "atom_table.h"
+#include "sidecar_file.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+
+// Кэш результатов встраивания словосочетаний в предложения обучающего множества (файл-спутник корпуса).
+// Для каждого предложения, которое встраивание изменяет, хранятся правки (замены лемм, удаляемые токены и итоговая колонка HEAD),
+// проиндексированные смещением предложения в файле корпуса; предложения, отсутствующие в кэше, встраивание не изменяет.
+// Кэш действителен для конкретного корпуса (размер и время модификации) и конкретного набора шаблонов словосочетаний
+// (отпечаток индекса шаблонов, учитывающий фильтрацию по главному словарю), поэтому для разных стадий (словарь без фильтрации,
+// словарь с фильтрацией, обучение) существуют отдельные файлы <корпус>.mwe-<отпечаток>.
+// Кэш записывается при последовательном проходе по корпусу (однопоточно) и затем используется только для чтения
+// (потокобезопасно): применение правок заменяет поиск словосочетаний в предложении.
+class MweSubstitutionCache
+{
+public:
+  ~MweSubstitutionCache()
+  {
+    SidecarFile::unmap(mapped_base, mapped_size);
+  }
+  // открытие кэша для корпуса: загрузка действительного кэша или (при allowRecording) подготовка к записи нового
+  // (false -- кэш не используется)
+  bool open(const std::string& corpusFn, const MweVocabulary& mweVocabulary, bool allowRecording)
+  {
+    SidecarFile::SourceStamp stamp;
+    if ( mweVocabulary.empty() || !SidecarFile::source_stamp(corpusFn, stamp) )
+      return false;
+    corpus_stamp = stamp;
+    fingerprint = mweVocabulary.patterns_fingerprint();
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".mwe-%016llx", static_cast<unsigned long long>(fingerprint));
+    cache_fn = corpusFn + suffix;
+    if ( load() )
+    {
+      std::cout << "MWE substitutions cache: " << cache_fn << " (" << records_count << " sentences)" << std::endl;
+      return true;
+    }
+    recording = allowRecording;
+    return recording;
+  } // method-end
+  bool is_loaded() const
+  {
+    return mapped_base != nullptr;
+  } // method-end
+  bool is_recording() const
+  {
+    return recording;
+  } // method-end
+  // встраивание словосочетаний в предложение, начинающееся в файле корпуса со смещения sentenceOffset
+  // (в режиме чтения применяются сохранённые правки, в режиме записи результат встраивания запоминается)
+  void substitute(const MweVocabulary& mweVocabulary, ConllSentence& sentence, uint64_t sentenceOffset)
+  {
+    if ( is_loaded() )
+    {
+      if ( !apply(sentence, sentenceOffset) )
+        mweVocabulary.put_phrases_into_sentence(sentence);
+      return;
+    }
+    if ( !recording )
+    {
+      mweVocabulary.put_phrases_into_sentence(sentence);
+      return;
+    }
+    size_t n = sentence.size();
+    before_lemmas.resize(n);
+    before_heads.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+      before_lemmas[i] = sentence.atom(i, 2);
+      before_heads[i] = sentence.head(i);
+    }
+    uint64_t lemmas_hash = hash_lemmas(sentence);
+    mweVocabulary.put_phrases_into_sentence(sentence);
+    record(sentence, sentenceOffset, n, lemmas_hash);
+  } // method-end
+  // сохранение записанного кэша (выполняется по завершении полного прохода по корпусу)
+  bool save()
+  {
+    if ( !recording )
+      return true;
+    recording = false;
+    std::vector<uint64_t> string_offsets(pool.size() + 1, 0);
+    std::string string_bytes;
+    auto& atom_table = AtomTable::global();
+    for (size_t i = 0; i < pool.size(); ++i)
+    {
+      string_bytes += atom_table.str(pool[i]);
+      string_offsets[i + 1] = string_bytes.size();
+    }
+    Header hdr;
+    std::memcpy(hdr.magic, MAGIC, sizeof(hdr.magic));
+    hdr.version = VERSION;
+    hdr.corpus = corpus_stamp;
+    hdr.fingerprint = fingerprint;
+    hdr.records_count = new_records.size();
+    hdr.data_count = new_data.size();
+    hdr.strings_count = pool.size();
+    hdr.string_bytes = string_bytes.size();
+    std::string tmp_fn = SidecarFile::temp_filename(cache_fn);
+    FILE* f = fopen(tmp_fn.c_str(), "wb");
+    if ( !f )
+    {
+      std::cerr << "MWE substitutions cache: can't create " << tmp_fn << std::endl;
+      return false;
+    }
+    bool ok = SidecarFile::write_section(f, &hdr, sizeof(hdr))
+              && SidecarFile::write_section(f, new_records.data(), new_records.size() * sizeof(Record))
+              && SidecarFile::write_section(f, new_data.data(), new_data.size() * sizeof(uint32_t))
+              && SidecarFile::write_section(f, string_offsets.data(), string_offsets.size() * sizeof(uint64_t))
+              && SidecarFile::write_section(f, string_bytes.data(), string_bytes.size());
+    ok = (fclose(f) == 0) && ok;
+    if ( !ok || rename(tmp_fn.c_str(), cache_fn.c_str()) != 0 )
+    {
+      remove(tmp_fn.c_str());
+      std::cerr << "MWE substitutions cache: can't save " << cache_fn << std::endl;
+      return false;
+    }
+    std::cout << "MWE substitutions cache saved: " << cache_fn << " (" << new_records.size() << " sentences)" << std::endl;
+    new_records.clear();
+    new_data.clear();
+    return true;
+  } // method-end
+private:
+  static constexpr char MAGIC[8] = {'M', 'W', 'E', 'S', 'U', 'B', 'S', 0};
+  static constexpr uint32_t VERSION = 1;
+  // заголовок файла; за ним следуют секции (каждая выровнена на 8 байт): записи, данные записей, смещения строк пула, байты строк пула
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved = 0;
+    SidecarFile::SourceStamp corpus;
+    uint64_t fingerprint;
+    uint64_t records_count;
+    uint64_t data_count;
+    uint64_t strings_count;
+    uint64_t string_bytes;
+  };
+  // запись о предложении (записи упорядочены по смещениям предложений)
+  // данные записи (в массиве data, начиная с data_begin): исходное количество токенов, хэш лемм (два слова),
+  // итоговое количество токенов, количество замен лемм, количество удаляемых токенов,
+  // пары <исходный индекс токена, номер строки пула>, исходные индексы удаляемых токенов, итоговая колонка HEAD
+  struct Record
+  {
+    uint64_t offset;
+    uint64_t data_begin;
+  };
+
+  std::string cache_fn;
+  SidecarFile::SourceStamp corpus_stamp;
+  uint64_t fingerprint = 0;
+  // загруженный кэш (отображение файла в память)
+  const char* mapped_base = nullptr;
+  size_t mapped_size = 0;
+  const Record* records = nullptr;
+  size_t records_count = 0;
+  const uint32_t* data = nullptr;
+  size_t data_count = 0;
+  std::vector<uint32_t> pool_atoms;       // атомы строк пула загруженного кэша
+  // записываемый кэш
+  bool recording = false;
+  std::vector<Record> new_records;
+  std::vector<uint32_t> new_data;
+  std::vector<uint32_t> pool;             // атомы строк пула записываемого кэша
+  std::unordered_map<uint32_t, uint32_t> pool_ids;
+  std::vector<uint32_t> before_lemmas;    // состояние предложения до встраивания
+  std::vector<int> before_heads;
+  std::vector<uint32_t> erased;
+
+  // хэш лемм предложения (FNV-1a), служит для контроля соответствия записи предложению
+  static uint64_t hash_lemmas(const ConllSentence& sentence)
+  {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (auto& t : sentence)
+    {
+      if ( t.size() > 2 )
+        for (unsigned char c : t[2])
+          h = (h ^ c) * 0x100000001b3ULL;
+      h = (h ^ 0xFF) * 0x100000001b3ULL;
+    }
+    return h;
+  } // method-end
+  // запоминание правок, которые встраивание словосочетаний внесло в предложение
+  void record(const ConllSentence& sentence, uint64_t sentenceOffset, size_t beforeCount, uint64_t lemmasHash)
+  {
+    size_t n = sentence.size();
+    size_t header_pos = new_data.size();
+    new_data.insert(new_data.end(), { static_cast<uint32_t>(beforeCount),
+                                      static_cast<uint32_t>(lemmasHash), static_cast<uint32_t>(lemmasHash >> 32),
+                                      static_cast<uint32_t>(n), 0, 0 });
+    bool changed = (n != beforeCount);
+    uint32_t lemma_edits = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+      int o = sentence.origin(i);
+      if ( sentence.head(i) != before_heads[o] || static_cast<size_t>(o) != i )
+        changed = true;
+      uint32_t lemma = sentence.atom(i, 2);
+      if ( lemma == before_lemmas[o] )
+        continue;
+      auto res = pool_ids.emplace(lemma, pool.size());
+      if ( res.second )
+        pool.push_back(lemma);
+      new_data.push_back(o);
+      new_data.push_back(res.first->second);
+      ++lemma_edits;
+    }
+    if ( !changed && lemma_edits == 0 )
+    {
+      new_data.resize(header_pos);
+      return;
+    }
+    erased.assign(beforeCount, 1);
+    for (size_t i = 0; i < n; ++i)
+      erased[ sentence.origin(i) ] = 0;
+    uint32_t erased_count = 0;
+    for (size_t o = 0; o < beforeCount; ++o)
+      if ( erased[o] )
+      {
+        new_data.push_back(o);
+        ++erased_count;
+      }
+    for (size_t i = 0; i < n; ++i)
+      new_data.push_back( static_cast<uint32_t>(sentence.head(i)) );
+    new_data[header_pos + 4] = lemma_edits;
+    new_data[header_pos + 5] = erased_count;
+    new_records.push_back( Record{sentenceOffset, header_pos} );
+  } // method-end
+  // применение сохранённых правок к предложению (false -- записи нет или она не соответствует предложению)
+  bool apply(ConllSentence& sentence, uint64_t sentenceOffset) const
+  {
+    auto it = std::lower_bound( records, records + records_count, sentenceOffset,
+                                [](const Record& r, uint64_t offset) { return r.offset < offset; } );
+    if ( it == records + records_count || it->offset != sentenceOffset )
+      return true;  // встраивание не изменяет предложение
+    const uint32_t* d = data + it->data_begin;
+    size_t available = data_count - it->data_begin;
+    if ( available < 6 || d[0] != sentence.size() )
+      return false;
+    uint64_t lemmas_hash = d[1] | (static_cast<uint64_t>(d[2]) << 32);
+    uint32_t n = d[3], lemma_edits = d[4], erased_count = d[5];
+    if ( available < 6 + 2 * static_cast<size_t>(lemma_edits) + erased_count + n || hash_lemmas(sentence) != lemmas_hash )
+      return false;
+    if ( n + erased_count != sentence.size() )
+      return false;
+    const uint32_t* edits = d + 6;
+    const uint32_t* erased_begin = edits + 2 * lemma_edits;
+    const uint32_t* heads = erased_begin + erased_count;
+    for (uint32_t k = 0; k < lemma_edits; ++k)
+      if ( edits[2 * k] >= sentence.size() || edits[2 * k + 1] >= pool_atoms.size() )
+        return false;
+    for (uint32_t k = 0; k < erased_count; ++k)   // удаляемые токены упорядочены по возрастанию
+      if ( erased_begin[k] >= sentence.size() || (k > 0 && erased_begin[k - 1] >= erased_begin[k]) )
+        return false;
+    // правки применяются в том же порядке, что и при встраивании: замена лемм, удаление токенов, итоговые синтаксические связи
+    auto& atom_table = AtomTable::global();
+    for (uint32_t k = 0; k < lemma_edits; ++k)
+    {
+      uint32_t atom = pool_atoms[ edits[2 * k + 1] ];
+      sentence.set_field(edits[2 * k], 2, atom_table.str(atom), atom);
+    }
+    struct Positions
+    {
+      const uint32_t* b;
+      const uint32_t* e;
+      const uint32_t* begin() const { return b; }
+      const uint32_t* end() const { return e; }
+      bool empty() const { return b == e; }
+    };
+    sentence.erase_tokens( Positions{erased_begin, heads} );
+    for (uint32_t i = 0; i < n; ++i)
+      sentence.set_head(i, static_cast<int>(heads[i]));
+    return true;
+  } // method-end
+  // загрузка действительного кэша (без поддержки POSIX кэш не используется: отметка корпуса не вычисляется, и open() до загрузки не доходит)
+  bool load()
+  {
+    size_t file_size = 0;
+    const char* base = SidecarFile::map(cache_fn, sizeof(Header), file_size);
+    if ( !base )
+      return false;
+    Header hdr;
+    std::memcpy(&hdr, base, sizeof(hdr));
+    bool ok = std::memcmp(hdr.magic, MAGIC, sizeof(hdr.magic)) == 0 && hdr.version == VERSION && hdr.fingerprint == fingerprint
+              && hdr.corpus == corpus_stamp;
+    size_t offset = sizeof(Header);
+    const Record* recs = ok ? SidecarFile::map_section<Record>(base, file_size, offset, hdr.records_count) : nullptr;
+    const uint32_t* dt = recs ? SidecarFile::map_section<uint32_t>(base, file_size, offset, hdr.data_count) : nullptr;
+    const uint64_t* string_offsets = dt ? SidecarFile::map_section<uint64_t>(base, file_size, offset, hdr.strings_count + 1) : nullptr;
+    const char* string_bytes = string_offsets ? SidecarFile::map_section<char>(base, file_size, offset, hdr.string_bytes) : nullptr;
+    ok = ok && string_bytes;
+    for (size_t i = 0; ok && i < hdr.records_count; ++i)
+      ok = recs[i].data_begin <= hdr.data_count && (i == 0 || recs[i - 1].offset < recs[i].offset);
+    // строки пула (дескрипторы словосочетаний) интернируются однократно
+    auto& atom_table = AtomTable::global();
+    pool_atoms.clear();
+    for (size_t i = 0; ok && i < hdr.strings_count; ++i)
+    {
+      ok = string_offsets[i] <= string_offsets[i + 1] && string_offsets[i + 1] <= hdr.string_bytes;
+      if ( ok )
+        pool_atoms.push_back( atom_table.intern(std::string_view(string_bytes + string_offsets[i], string_offsets[i + 1] - string_offsets[i])) );
+    }
+    if ( !ok )
+    {
+      SidecarFile::unmap(base, file_size);
+      pool_atoms.clear();
+      return false;
+    }
+    mapped_base = base;
+    mapped_size = file_size;
+    records = recs;
+    records_count = hdr.records_count;
+    data = dt;
+    data_count = hdr.data_count;
+    return true;
+  } // method-end
+}; // class-decl-end
+
+
+#endif /* MWE_SUBSTITUTION_CACHE_H_ */
@@ -2,16 +2,23 @@
 #define MWE_VOCABULARY_H_
 
 #include "str_conv.h"
+#include "conll_sentence.h"
+#include "atom_table.h"
 #include "original_word2vec_vocabulary.h"
 #include "learning_example.h"
+#include "sentence_arena.h"
+#include "mwe_pattern_index.h"
+#include "mwe_match_stats.h"
+#include "collapsing_plan.h"
 
 #include <memory>
 #include <string>
 #include <vector>
 #include <map>
-#include <queue>
+#include <memory_resource>
 #include <iostream>
 #include <optional>
+#include <chrono>
 
 
 // представление узла синтаксического дерева
@@ -82,89 +89,23 @@ public:
   {
   }
   // загрузка словаря
-  bool load(const std::string& fn, std::shared_ptr< OriginalWord2VecVocabulary > main_vocabulary = nullptr)
+  // если деревья словосочетаний не требуются (withTrees == false), индекс шаблонов берётся из двоичного кэша рядом со списком
+  // (кэш создаётся при первой загрузке текстового списка и пересоздаётся при изменении списка)
+  bool load(const std::string& fn, std::shared_ptr< OriginalWord2VecVocabulary > main_vocabulary = nullptr, bool withTrees = false)
   {
-//    const std::vector<std::string> TEST_DATA = {
-//        "точка_зрения\t[точка[зрение]]",
-//        "подводная_лодка\t[[подводный]лодка]",
-//        "железная_дорога\t[[железный]дорога]",
-//        "канатная_дорога\t[[канатный]дорога]",
-//        "подзорная_труба\t[[подзорный]труба]",
-//        "земной_шар\t[[земной]шар]",
-//        "программное_обеспечение\t[[программный]обеспечение]",
-//        "торговый_центр\t[[торговый]центр]",
-//        "воздушное_судно\t[[воздушный]судно]",
-//        "транспортное_средство\t[[транспортный]средство]",
-//        "моющее_средство\t[[моющий]средство]",
-//        "средства_массовой_информации\t[средство[[массовый]информация]]",
-//        "денежные_средства\t[[денежный]средство]",
-//        "населенный_пункт\t[[населенный]пункт]",
-//        "черная_дыра\t[[черный]дыра]",
-//        "часовой_пояс\t[[часовой]пояс]",
-//        "морская_свинка\t[[морской]свинка]",
-//        "божья_коровка\t[[божий]коровка]",
-//        "летучая_мышь\t[[летучий]мышь]",
-//        "спусковой_крючок\t[[спусковой]крючок]",
-//        "принять_душ\t[принять[душ]]",
-//        "чинить_препятствия\t[чинить[препятствие]]",
-//        "башня_из_слоновой_кости\t[башня[из[[слоновый]кость]]]",
-//        "вставлять_палки_в_колеса\t[вставлять[палка][в[колесо]]]",
-//        "взять_быка_за_рога\t[взять[бык][за[рог]]]",
-//        "бить_баклуши\t[бить[баклуша]]",
-//        "крыша_поехала\t[[крыша]поехать]",
-//        "кот_в_мешке\t[кот[в[мешок]]]",
-//        "сыграть_в_ящик\t[сыграть[в[ящик]]]",
-//        "подложить_свинью\t[подложить[свинья]]",
-//        };
-
-    std::ifstream wme_ifs(fn.c_str());
-    std::string line;
-    std::optional< std::multimap<std::string, std::shared_ptr<Phrase>>::iterator> last_inserted_mwe;
-    while ( std::getline(wme_ifs, line).good() )
+    mwes.clear();
+    SidecarFile::SourceStamp stamp;
+    bool has_stamp = SidecarFile::source_stamp(fn, stamp);
+    std::string cache_fn = fn + ".idx";
+    if ( withTrees || !has_stamp || !pattern_index.load_cache(cache_fn, stamp) )
     {
-      // отрежем комментарий
-      size_t comment_sign_pos = line.find('#');
-      if (comment_sign_pos != std::string::npos)
-        line.erase( comment_sign_pos );
-      // подчистим строку, после отрезания комментария (перед ним могут быть пробелы)
-      StrConv::trim(line);
-      if (line.empty()) continue;
-
-      // разбиваем запись по символу табуляции
-      size_t tab1 = line.find_first_of("\t");
-      if (tab1 == std::string::npos) // пропускаем некорректные записи
-      {
-        last_inserted_mwe.reset();
-        std::cerr << "mwe: invalid line: " << line << std::endl;
-        continue;
-      }
-
-      std::string descr = line.substr(0, tab1);
-      std::shared_ptr<TreeNode> tree = str2tree( line.substr(tab1+1) );
-
-      if ( descr != "+" )
-      {
-        std::shared_ptr<Phrase> phrase = std::make_shared<Phrase>();
-        phrase->str = descr;
-        phrase->trees.push_back(tree);
-        phrase->main_lemma = tree->word;
-        last_inserted_mwe = mwes.insert( std::make_pair(tree->word, phrase) );
-      }
-      else
-      {
-        if ( !last_inserted_mwe ) // пропускаем некорректные записи
-        {
-          std::cerr << "mwe: invalid line: " << line << std::endl;
-          continue;
-        }
-        auto& phrase = (*last_inserted_mwe)->second;
-        if ( tree->word != phrase->main_lemma ) // контроль того, что вершина та же
-        {
-          std::cerr << "mwe: head change error: " << line << std::endl;
-          continue;
-        }
-        phrase->trees.push_back(tree);
-      }
+      load_text(fn);
+      // компилируем словосочетания в плоский индекс шаблонов (используется при поиске словосочетаний в предложениях)
+      pattern_index.build(mwes);
+      if ( has_stamp && !pattern_index.save_cache(cache_fn, stamp) )
+        std::cerr << "mwe: can't save pattern index cache: " << cache_fn << std::endl;
+      if ( !withTrees )
+        mwes.clear();
     }
 
     // профильтруем фразы, чтобы удовлетворяли частотному порогу главного словаря (если он уже построен)
@@ -181,180 +122,210 @@ public:
         else
           it = mwes.erase(it);
       }
+      auto& atom_table = AtomTable::global();
+      pattern_index.retain_phrases( [&](uint32_t descr_atom) { return main_vocabulary->word_to_idx( atom_table.str(descr_atom) ) != INVALID_IDX; } );
     }
-
+    match_stats.reset();
     return true;
   } // method-end
   // поиск фраз в предложении и встраивание их туда
-  void put_phrases_into_sentence( std::vector< std::vector<std::string> >& sentence_matrix ) const
+  void put_phrases_into_sentence( ConllSentence& sentence_matrix ) const
   {
     // Переделываем само предложение следующим образом.
     // 1) Там, где обнаруживается словосочетание, являющееся лексической единицей, оно полностью вытесняется из предложения и замещается
     // одним токеном (необходимые синтаксические ссылки исправляются).
     // 2) Если словосочетание диагностическое, то вместо леммы слова, значение которого уточняется, подставляется дескриптор словосочетания.
     // Дескриптор фактически заменяет одно из значений многозначного слова.
-
-    // сначала ищем каждое слово предложения в индексе маркир.вершин словосочетаний
-    // формируем short-list словосочетаний, которые нужно поискать в предложении
-    std::map< size_t, std::vector<std::shared_ptr<Phrase>> > phCandidates;  // отображение из индекса токена предложения в список фраз-кандидатов
-    ph2s_search_candidates(sentence_matrix, phCandidates);
-    if ( phCandidates.empty() )
+    if ( pattern_index.empty() )
       return;
 
-    // строим для рассматриваемого предложения мэппинг из токена в список его синтаксических потомков
-    // (это вспомогательная структура для ускорения поиска синтакс. потомков заданного слова)
-    std::map< size_t, std::vector<size_t> > deps;
-    if ( !ph2s_build_deps(sentence_matrix, deps) )
+    // предварительный отсев: предложения без единой вершины словосочетания не рассматриваются
+    // (сигнатура предложения служит для отсева фраз, слова которых в предложении заведомо отсутствуют)
+    auto& prefilter = match_stats.local_prefilter();
+    ++prefilter.sentences;
+    MwePatternIndex::Signature signature;
+    if ( !pattern_index.sentence_signature(sentence_matrix, signature) )
+    {
+      ++prefilter.rejected_sentences;
       return;
+    }
 
-    // пытаемся найти фразы-кандидаты в синтакс.дереве предложения
-    std::set<size_t> match;
-    while ( !phCandidates.empty() )
+    // вспомогательные структуры размещаются в арене потока (вся их память освобождается разом при обработке следующего предложения)
+    auto& arena = SentenceArena::local();
+    arena.reset();
+
+    // строим для рассматриваемого предложения списки синтаксических потомков токенов
+    MwePatternIndex::SentenceDeps deps(arena.resource());
+    if ( !MwePatternIndex::build_deps(sentence_matrix, deps) )
+      return;
+    MwePatternIndex::MatchScratch scratch(arena.resource());
+    std::pmr::vector<uint32_t> match(arena.resource());
+    scratch.queue.reserve( pattern_index.max_nodes() );
+    match.reserve( pattern_index.max_nodes() );
+
+    // каждое слово предложения ищем среди маркированных вершин словосочетаний и пытаемся сопоставить фразы-кандидаты с синтакс.деревом
+    size_t tidx = 0;
+    while ( tidx < sentence_matrix.size() )
     {
-      auto c = *phCandidates.begin();
-      phCandidates.erase(phCandidates.begin());
-      for (auto& ph : c.second)
+      // кандидаты ищутся по атому леммы, а при наличии вершин, сопоставляемых по токену, -- и по атому токена
+      uint32_t head_atoms[2] = { sentence_matrix.atom(tidx, MwePatternIndex::LEMMA_COLUMN), sentence_matrix.atom(tidx, MwePatternIndex::FORM_COLUMN) };
+      size_t head_atoms_count = (pattern_index.has_token_heads() && head_atoms[1] != head_atoms[0]) ? 2 : 1;
+      bool restart = false;
+      for (size_t h = 0; h < head_atoms_count && !restart; ++h)
       {
-        if ( compare_trees(sentence_matrix, deps, c.first, ph, match) )
+        auto candidates = pattern_index.phrases_for(head_atoms[h]);
+        for (auto ph = candidates.first; ph != candidates.second; ++ph)
         {
-//          dbg_print_sentence(sentence_matrix);
-//          dbg_print_sentence_conll(sentence_matrix);
+          if ( !pattern_index.may_match(*ph, signature) )
+          {
+            ++prefilter.rejected_candidates;
+            continue;
+          }
+          auto& stats = match_stats.local(*ph);
+          auto match_start = std::chrono::steady_clock::now();
+          bool matched = pattern_index.match_phrase(sentence_matrix, deps, tidx, *ph, scratch, match);
+          stats.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - match_start).count();
+          ++stats.candidates;
+          if ( !matched )
+            continue;
+          ++stats.matches;
+          uint32_t descr_atom = pattern_index.phrase(*ph).descr_atom;
+          const std::string& descr = AtomTable::global().str(descr_atom);
+          signature.add(descr_atom);  // удаление токенов сигнатуру не сужает (она остаётся надмножеством)
           if ( !match.empty() )
           {
-            ph2s_replace(sentence_matrix, c.first, match, ph->str);
-            // если струкутура предложения поменялась, индексы во вспомогательных структурах (phCandidates, deps) могут стать невалидными
-            // перестроим их по уже скорректированной sentence_matrix
-            ph2s_search_candidates(sentence_matrix, phCandidates);
-            if ( phCandidates.empty() ) return;
-            if ( !ph2s_build_deps(sentence_matrix, deps) ) return;
+            ph2s_replace(sentence_matrix, tidx, match, descr, descr_atom);
+            // структура предложения поменялась: перестраиваем списки потомков и просматриваем предложение заново
+            if ( !MwePatternIndex::build_deps(sentence_matrix, deps) ) return;
+            restart = true;
             break;
           }
           else
-            sentence_matrix[c.first][2] = ph->str;
-//          dbg_print_sentence_conll(sentence_matrix);
-//          static size_t dbg_cnt = 0;
-//          if (++dbg_cnt == 10)
-//            exit(0);
+            sentence_matrix.set_field(tidx, 2, descr, descr_atom);
         }
       }
-    }
-
-  } // method-end
-  // вспомогательный метод для incorporate_phrases_to_sentence
-  // строит отображение из индекса токена предложения в список фраз-кандидатов
-  void ph2s_search_candidates(const std::vector< std::vector<std::string> >& sentence_matrix, std::map< size_t, std::vector< std::shared_ptr<Phrase> > >& phCandidates) const
-  {
-    phCandidates.clear();
-    for (size_t tidx = 0; tidx < sentence_matrix.size(); ++tidx)
-    {
-      auto& norma = sentence_matrix[tidx][2];
-      auto range = mwes.equal_range(norma);
-      for (auto i = range.first; i != range.second; ++i)
-        phCandidates[tidx].push_back(i->second);
+      tidx = restart ? 0 : tidx + 1;
     }
   } // method-end
   // вспомогательный метод для incorporate_phrases_to_sentence
-  // строит структуру для быстрого поиска зависимых данной вершины дерева
-  bool ph2s_build_deps(const std::vector< std::vector<std::string> >& sentence_matrix, std::map< size_t, std::vector<size_t> >& deps) const
-  {
-    deps.clear();
-    try
-    {
-      for (size_t tidx = 0; tidx < sentence_matrix.size(); ++tidx)
-        deps[ std::stoi(sentence_matrix[tidx][6]) - 1 ].push_back(tidx);
-    } catch (...) {
-      return false;
-    }
-    return true;
-  } // method-end
-  // вспомогательный метод для incorporate_phrases_to_sentence
   // замещает словосочетание в предложении
-  void ph2s_replace( std::vector< std::vector<std::string> >& sentence_matrix,
+  void ph2s_replace( ConllSentence& sentence_matrix,
                      size_t marked_position,
-                     std::set<size_t> match,
-                     const std::string& descr) const
+                     std::pmr::vector<uint32_t>& match,
+                     const std::string& descr,
+                     uint32_t descr_atom) const
   {
-    // строим структуру для хрениния номеров токенов в поле синтаксических ссылок
-    std::vector<size_t> heads;
-    for (size_t idx = 0; idx < sentence_matrix.size(); ++idx)
-      heads.push_back( std::stoi(sentence_matrix[idx][6]) );
     // всякую синтаксическую связь, ведущую в match, перекидываем на токен-дескриптор
-    for (auto& h : heads)
-      if ( match.find(h-1) != match.end() )
-        h = marked_position + 1;
-    // выкидываем из sentence_matrix все токены из match, кроме marked_position
-    for (auto it = match.rbegin(); it != match.rend(); ++it)
+    for (size_t idx = 0; idx < sentence_matrix.size(); ++idx)
+      if ( std::binary_search(match.begin(), match.end(), static_cast<uint32_t>(sentence_matrix.head(idx)-1)) )
+        sentence_matrix.set_head(idx, marked_position + 1);
+    // маркированная вершина остаётся в предложении (с дескриптором вместо леммы)
+    auto marked_it = std::lower_bound(match.begin(), match.end(), static_cast<uint32_t>(marked_position));
+    if ( marked_it != match.end() && *marked_it == marked_position )
     {
-      size_t pos = *it;
-      if (pos == marked_position)
-      {
-        sentence_matrix[marked_position][2] = descr;
-        continue;
-      }
-      sentence_matrix.erase(sentence_matrix.begin() + pos);
-      heads.erase(heads.begin() + pos);
-      // перенумеруем токены, после удаления
-      for (size_t idx = pos; idx < sentence_matrix.size(); ++idx)
-        sentence_matrix[idx][0] = std::to_string(idx+1);
-      for (auto& h : heads)
-        if (h > pos+1)
-          --h;
+      sentence_matrix.set_field(marked_position, 2, descr, descr_atom);
+      match.erase(marked_it);
     }
-    // переносим откорректированные синтаксические ссылки в sentence_matrix
-    for (size_t idx = 0; idx < heads.size(); ++idx)
-      sentence_matrix[idx][6] = std::to_string(heads[idx]);
+    // выкидываем из sentence_matrix остальные токены из match за один проход
+    // (токены перенумеровываются, синтаксические ссылки корректируются)
+    sentence_matrix.erase_tokens(match);
   } // method-end
 
   // вычисление групп векторов, для которых необходимо выполнить свёртывание
-  // (свёртывание временно выделенных словосочетаний к единому вектору вершины)
-  void process_transient(std::shared_ptr< OriginalWord2VecVocabulary > main_vocabulary, std::vector< std::vector< std::pair<size_t, float> > >& collapsing_info)
+  // (свёртывание временно выделенных словосочетаний к единому вектору вершины):
+  // вектор вершины заменяется взвешенным средним между ним и векторами временных словосочетаний с этой вершиной
+  // (веса пропорциональны частотам); при заданном log план выводится в протокол
+  void process_transient(std::shared_ptr< OriginalWord2VecVocabulary > main_vocabulary, CollapsingPlan& plan, std::ostream* log = nullptr)
   {
     const size_t OUT_OF_VOCABULARY = std::numeric_limits<size_t>::max();
-    collapsing_info.clear();
-    for (auto it = mwes.begin(); it != mwes.end(); )
+    auto& atom_table = AtomTable::global();
+    plan.clear();
+    std::vector<uint32_t> transients;
+    std::vector<size_t> transients_idxs;
+    for (uint32_t i = 0; i < pattern_index.phrases_count(); )
     {
       // выделяем блок словосочетаний с общей вершиной, не вошедших в словарь дистрибутивной модели (т.наз., временных словосочетаний)
-      auto range = mwes.equal_range(it->first);
-      it = range.second;
-      std::vector<std::shared_ptr<Phrase>> transients;
-      for (auto i = range.first; i != range.second; ++i)
+      // (фразы с общей вершиной следуют в индексе подряд)
+      uint32_t head_atom = pattern_index.phrase(i).head_atom;
+      transients.clear();
+      for ( ; i < pattern_index.phrases_count() && pattern_index.phrase(i).head_atom == head_atom; ++i)
       {
         // будем ориентироваться по первому дереву (варианту) фразы
-        auto first_tree = *(i->second->trees.begin());
-        if ( first_tree->out_of_match ) // если узел верхнего уровня не вошел в словарь модели (т.е. временный)
-          transients.push_back(i->second);
+        if ( pattern_index.is_transient(i) ) // если узел верхнего уровня не вошел в словарь модели (т.е. временный)
+          transients.push_back( pattern_index.phrase(i).descr_atom );
       }
       if ( transients.empty() ) // если только словарные словосочетания с такой вершиной
         continue;
       // находим веса вершины и временных словосочетаний
       // (для последующего вычисления взвешенного среднего между вектором вершины и векторами временных словосочетаний)
-std::cout << "COLLAPSING: " << transients.front()->main_lemma << std::endl;
-      size_t head_idx = main_vocabulary->word_to_idx( transients.front()->main_lemma );
+      const std::string& main_lemma = atom_table.str(head_atom);
+      if (log)
+        *log << "COLLAPSING: " << main_lemma << std::endl;
+      size_t head_idx = main_vocabulary->word_to_idx( main_lemma );
       if ( head_idx == OUT_OF_VOCABULARY ) continue;
       uint64_t head_sum = main_vocabulary->idx_to_data( head_idx ).cn;  // вычислим количество упоминаний вершины вне словосочетаний (без учёта сабсэмплинга, т.к. meet_counter также вычисляются без учёта сабсэмплинга)
       size_t total_sum = head_sum;
-      for (auto& t : transients)
+      transients_idxs.clear();
+      for (auto t : transients)
       {
-        size_t phrase_idx = main_vocabulary->word_to_idx( t->str );
+        size_t phrase_idx = main_vocabulary->word_to_idx( atom_table.str(t) );
+        transients_idxs.push_back(phrase_idx);
         if ( phrase_idx == OUT_OF_VOCABULARY ) continue;
         total_sum += main_vocabulary->idx_to_data( phrase_idx ).cn;
       }
-      std::vector< std::pair<size_t, float> > vectors_indexes_and_weights;
-      vectors_indexes_and_weights.push_back( std::make_pair( head_idx, (float)head_sum/(float)total_sum ) );
-std::cout << "  " << transients.front()->main_lemma << ", " << ((float)head_sum/(float)total_sum) << std::endl;
-      for (auto& t : transients)
+      plan.begin_group(head_idx);
+      plan.add_source( head_idx, (float)head_sum/(float)total_sum );
+      if (log)
+        *log << "  " << main_lemma << ", " << ((float)head_sum/(float)total_sum) << std::endl;
+      for (size_t t = 0; t < transients.size(); ++t)
       {
-        size_t phrase_idx = main_vocabulary->word_to_idx( t->str );
+        size_t phrase_idx = transients_idxs[t];
         if ( phrase_idx == OUT_OF_VOCABULARY ) continue;
         size_t phrase_cn = main_vocabulary->idx_to_data( phrase_idx ).cn;
-        vectors_indexes_and_weights.push_back( std::make_pair( phrase_idx, (float)phrase_cn/(float)total_sum ) );
-std::cout << "  " << t->str << ", " << ((float)phrase_cn/(float)total_sum) << std::endl;
+        plan.add_source( phrase_idx, (float)phrase_cn/(float)total_sum );
+        if (log)
+          *log << "  " << atom_table.str(transients[t]) << ", " << ((float)phrase_cn/(float)total_sum) << std::endl;
       }
-      collapsing_info.push_back(vectors_indexes_and_weights);
     }
   } // method-end
 
 
+  // отметка строк главного словаря, соответствующих временным словосочетаниям
+  // (после свёртывания их векторы не нужны и в экспортируемую модель не записываются)
+  void mark_transient_rows(std::shared_ptr< OriginalWord2VecVocabulary > main_vocabulary, std::vector<bool>& rows) const
+  {
+    const size_t OUT_OF_VOCABULARY = std::numeric_limits<size_t>::max();
+    auto& atom_table = AtomTable::global();
+    rows.assign(main_vocabulary->size(), false);
+    for (uint32_t i = 0; i < pattern_index.phrases_count(); ++i)
+    {
+      if ( !pattern_index.is_transient(i) )
+        continue;
+      size_t phrase_idx = main_vocabulary->word_to_idx( atom_table.str(pattern_index.phrase(i).descr_atom) );
+      if ( phrase_idx != OUT_OF_VOCABULARY )
+        rows[phrase_idx] = true;
+    }
+  } // method-end
+  bool empty() const
+  {
+    return pattern_index.empty();
+  } // method-end
+  // вывод статистики сопоставления шаблонов (после завершения обработки корпуса)
+  void report_match_stats(std::ostream& os) const
+  {
+    match_stats.report(pattern_index, os);
+  } // method-end
+  // отпечаток используемых шаблонов словосочетаний (с учётом фильтрации по главному словарю)
+  uint64_t patterns_fingerprint() const
+  {
+    return pattern_index.fingerprint();
+  } // method-end
+  // доступ к словосочетаниям в древесной форме (проиндексированы по вершинам; доступны, если словарь загружен с withTrees)
+  const std::multimap<std::string, std::shared_ptr<Phrase>>& get_phrases() const
+  {
+    return mwes;
+  } // method-end
+
   void dbg_print_mwe_lists()
   {
     std::cout << std::endl;
@@ -368,7 +339,97 @@ std::cout << "  " << t->str << ", " << ((float)phrase_cn/(float)total_sum) << st
 private:
   // хранилище словосочетаний в древесной форме (проидексированных по вершинам словосочетаний)
   std::multimap<std::string, std::shared_ptr<Phrase>> mwes;
+  // скомпилированный индекс шаблонов словосочетаний (для поиска словосочетаний в предложении)
+  MwePatternIndex pattern_index;
+  // статистика сопоставления шаблонов (пополняется из put_phrases_into_sentence)
+  mutable MweMatchStats match_stats;
+
+  // загрузка словосочетаний из текстового списка в древесной форме
+  void load_text(const std::string& fn)
+  {
+//    const std::vector<std::string> TEST_DATA = {
+//        "точка_зрения\t[точка[зрение]]",
+//        "подводная_лодка\t[[подводный]лодка]",
+//        "железная_дорога\t[[железный]дорога]",
+//        "канатная_дорога\t[[канатный]дорога]",
+//        "подзорная_труба\t[[подзорный]труба]",
+//        "земной_шар\t[[земной]шар]",
+//        "программное_обеспечение\t[[программный]обеспечение]",
+//        "торговый_центр\t[[торговый]центр]",
+//        "воздушное_судно\t[[воздушный]судно]",
+//        "транспортное_средство\t[[транспортный]средство]",
+//        "моющее_средство\t[[моющий]средство]",
+//        "средства_массовой_информации\t[средство[[массовый]информация]]",
+//        "денежные_средства\t[[денежный]средство]",
+//        "населенный_пункт\t[[населенный]пункт]",
+//        "черная_дыра\t[[черный]дыра]",
+//        "часовой_пояс\t[[часовой]пояс]",
+//        "морская_свинка\t[[морской]свинка]",
+//        "божья_коровка\t[[божий]коровка]",
+//        "летучая_мышь\t[[летучий]мышь]",
+//        "спусковой_крючок\t[[спусковой]крючок]",
+//        "принять_душ\t[принять[душ]]",
+//        "чинить_препятствия\t[чинить[препятствие]]",
+//        "башня_из_слоновой_кости\t[башня[из[[слоновый]кость]]]",
+//        "вставлять_палки_в_колеса\t[вставлять[палка][в[колесо]]]",
+//        "взять_быка_за_рога\t[взять[бык][за[рог]]]",
+//        "бить_баклуши\t[бить[баклуша]]",
+//        "крыша_поехала\t[[крыша]поехать]",
+//        "кот_в_мешке\t[кот[в[мешок]]]",
+//        "сыграть_в_ящик\t[сыграть[в[ящик]]]",
+//        "подложить_свинью\t[подложить[свинья]]",
+//        };
+
+    std::ifstream wme_ifs(fn.c_str());
+    std::string line;
+    std::optional< std::multimap<std::string, std::shared_ptr<Phrase>>::iterator> last_inserted_mwe;
+    while ( std::getline(wme_ifs, line).good() )
+    {
+      // отрежем комментарий
+      size_t comment_sign_pos = line.find('#');
+      if (comment_sign_pos != std::string::npos)
+        line.erase( comment_sign_pos );
+      // подчистим строку, после отрезания комментария (перед ним могут быть пробелы)
+      StrConv::trim(line);
+      if (line.empty()) continue;
+
+      // разбиваем запись по символу табуляции
+      size_t tab1 = line.find_first_of("\t");
+      if (tab1 == std::string::npos) // пропускаем некорректные записи
+      {
+        last_inserted_mwe.reset();
+        std::cerr << "mwe: invalid line: " << line << std::endl;
+        continue;
+      }
 
+      std::string descr = line.substr(0, tab1);
+      std::shared_ptr<TreeNode> tree = str2tree( line.substr(tab1+1) );
+
+      if ( descr != "+" )
+      {
+        std::shared_ptr<Phrase> phrase = std::make_shared<Phrase>();
+        phrase->str = descr;
+        phrase->trees.push_back(tree);
+        phrase->main_lemma = tree->word;
+        last_inserted_mwe = mwes.insert( std::make_pair(tree->word, phrase) );
+      }
+      else
+      {
+        if ( !last_inserted_mwe ) // пропускаем некорректные записи
+        {
+          std::cerr << "mwe: invalid line: " << line << std::endl;
+          continue;
+        }
+        auto& phrase = (*last_inserted_mwe)->second;
+        if ( tree->word != phrase->main_lemma ) // контроль того, что вершина та же
+        {
+          std::cerr << "mwe: head change error: " << line << std::endl;
+          continue;
+        }
+        phrase->trees.push_back(tree);
+      }
+    }
+  } // method-end
   // функция построения дерева по его строковому представлению
   std::shared_ptr<TreeNode> str2tree(const std::string& str) const
   {
@@ -453,97 +514,10 @@ private:
     } // while str isn't finished
     return holder->children[0];
   } // method-end
-  // проверка вхождения словосочетания в заданную позицию предложения
-  // при нахождении словосочетания возвращает множество индексов токенов, составляющих часть фразы, подлежащей замене на дескриптор
-  bool compare_trees( const std::vector< std::vector<std::string> >& sentence_matrix,
-                      const std::map< size_t, std::vector<size_t> >& deps,
-                      size_t match_point,
-                      std::shared_ptr<Phrase> phrase,
-                      std::set<size_t>& match_result ) const
-  {
-    for (auto& t : phrase->trees)
-    {
-      bool succ = compare_trees_helper(sentence_matrix, deps, match_point, t, match_result);
-      if (succ) return true;
-    }
-    return false;
-  } // method-end
-  bool compare_trees_helper( const std::vector< std::vector<std::string> >& sentence_matrix,
-                             const std::map< size_t, std::vector<size_t> >& deps,
-                             size_t match_point,
-                             std::shared_ptr<TreeNode> tree,
-                             std::set<size_t>& match_result ) const
-  {
-    // исходным состоянием является соответствие между match_point и вершиной tree (они уже сопоставлены)
-
-    match_result.clear();
-    if ( !tree->out_of_match )
-      match_result.insert(match_point);
-
-    // список подлежащих поиску узлов в виде кортежа <уже сопоставленный индекс токена, искомый узел, направление поиска>
-    std::queue< std::tuple<size_t, std::shared_ptr<TreeNode>, bool> > need_to_match;
-    auto add_match_query = [&need_to_match](size_t the_pos, std::shared_ptr<TreeNode> the_node)
-                           {
-                             if (the_node->head)
-                               need_to_match.push( std::make_tuple(the_pos, the_node->head, true));
-                             for (auto& n : the_node->children)
-                               need_to_match.push( std::make_tuple(the_pos, n, false) );
-                           };
-
-    add_match_query(match_point, tree);
-
-    // используем жадный алгоритм сопоставления
-    // допустим ищется словосочетание [пригласить[друг]]
-    // во фразе "друг пригласил друга на чай" у слова "пригласить" два потомка "друг"
-    // алгоритм попытается сопоставиться с первым попавшимся "друг", и если не сопоставит, то альтернативный вариант сопоставления рассматриваться не будет
-    // предполагается, что множественные сопоставления редки
-    // WARNING: возможно конструкции с предлогами будут проблемными: пригласил в четверг в бар
-
-    while ( !need_to_match.empty() )
-    {
-      size_t actual_token_no = std::get<0>(need_to_match.front());
-      std::shared_ptr<TreeNode> tree_node = std::get<1>(need_to_match.front());
-      bool search_up = std::get<2>(need_to_match.front());
-      size_t text_field_idx = tree_node->tok_match ? 1 : 2;
-      need_to_match.pop();
-      if (search_up)
-      {
-        int syn_head = std::stoi(sentence_matrix[actual_token_no][6]) - 1;
-        if (syn_head < 0 || sentence_matrix[syn_head][text_field_idx] != tree_node->word)
-        {
-          match_result.clear();
-          return false;
-        }
-        add_match_query(syn_head, tree_node);
-        if ( !tree_node->out_of_match )
-          match_result.insert(syn_head);
-      }
-      else
-      {
-        auto deps_it = deps.find(actual_token_no);
-        if ( deps_it == deps.end() ) { match_result.clear(); return false; } // у того, кто должен быть родителем, нет потомков вообще
-        bool found = false;
-        for (auto d : deps_it->second)
-          if (sentence_matrix[d][text_field_idx] == tree_node->word) // нашли зависимое
-          {
-            add_match_query(d, tree_node);
-            if ( !tree_node->out_of_match )
-              match_result.insert(d);
-            found = true;
-            break;
-          }
-        if (found)
-          continue;
-        match_result.clear();
-        return false; // не нашли очередного зависимого
-      }
-    } // while match isn't complete
-    return true;
-  } // method-end
 
 
   // отладочные процедуры
-  void dbg_print_sentence(const std::vector< std::vector<std::string> >& sentence_matrix) const
+  void dbg_print_sentence(const ConllSentence& sentence_matrix) const
   {
     std::string txt;
     for (auto& t : sentence_matrix)
@@ -551,7 +525,7 @@ private:
     txt.erase(0, 1);
     std::cout << txt << std::endl;
   }
-  void dbg_print_sentence_conll(const std::vector< std::vector<std::string> >& sentence_matrix) const
+  void dbg_print_sentence_conll(const ConllSentence& sentence_matrix) const
   {
     for (auto& t : sentence_matrix)
     {
@@ -4,11 +4,21 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <set>
 #include <fstream>
 #include <iostream>
-#include <regex>
 #include <limits>
+#include <thread>
+#include <charconv>
+#include <cstring>
+#ifndef _MSC_VER
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
 #include "vocabulary.h"
+#include "atom_table.h"
 
 class OriginalWord2VecVocabulary : public CustomVocabulary
 {
@@ -17,7 +27,6 @@ public:
   OriginalWord2VecVocabulary()
   : CustomVocabulary()
   {
-    vocabulary_hash.reserve(21000000);  // изначально устанавливаем размер хэш-отображения таковым, чтобы эффективно хранить 21 млн. элементов
   }
   // деструктор
   virtual ~OriginalWord2VecVocabulary()
@@ -25,37 +34,59 @@ public:
   }
   // функция загрузки словаря из файла
   // предполагается, что словарь отсортирован по убыванию частоты встречаемости слов
+  // файл отображается в память (без поддержки mmap -- считывается в буфер целиком) и разбирается параллельно порциями, выровненными по границам строк;
+  // записи добавляются в словарь в порядке следования в файле, хэш-отображение резервируется по фактическому числу записей
   bool load(const std::string& filename)
   {
-    // считываем словарь из файла
-    std::ifstream ifs( filename );
-    if (!ifs.good())
+#ifdef _MSC_VER
+    std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+    if ( !ifs.good() )
     {
       std::cerr << "Can't open vocabulary file: " << filename << std::endl;
       return false;
     }
-    std::string buf;
-    while ( std::getline(ifs, buf).good() )
+    size_t file_size = static_cast<size_t>(ifs.tellg());
+    if ( file_size == 0 )
+      return true;
+    std::vector<char> buffer(file_size);
+    ifs.seekg(0);
+    if ( !ifs.read(buffer.data(), file_size) )
     {
-      // каждая запись словаря содержит слово (строку) и абсолютную частоту встречаемости данного слова в корпусе (на основе которого построен словарь)
-      // элементы словарной записи разделены пробелами
-      const std::regex space_re("\\s+");
-      std::vector<std::string> vocabulary_record_components {
-          std::sregex_token_iterator(buf.cbegin(), buf.cend(), space_re, -1),
-          std::sregex_token_iterator()
-      };
-      if (vocabulary_record_components.size() != 2)
-      {
-        std::cerr << "Vocabulary loading error: " << filename << std::endl;
-        std::cerr << "Invalid record: " << buf << std::endl;
-        return false;
-      }
-      if ( stoplist.find(vocabulary_record_components[0]) != stoplist.end() )
-        continue;
-      vocabulary_hash[vocabulary_record_components[0]] = vocabulary.size(); // сразу строим хэш-отображение для поиска индекса слова в словаре по слову (строке)
-      vocabulary.emplace_back( vocabulary_record_components[0], std::stoull(vocabulary_record_components[1]) );
+      std::cerr << "Can't read vocabulary file: " << filename << std::endl;
+      return false;
     }
-    return true;
+    return load_mapped(buffer.data(), file_size, filename);
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if ( fd < 0 )
+    {
+      std::cerr << "Can't open vocabulary file: " << filename << std::endl;
+      return false;
+    }
+    struct stat st;
+    if ( fstat(fd, &st) != 0 )
+    {
+      close(fd);
+      std::cerr << "Can't open vocabulary file: " << filename << std::endl;
+      return false;
+    }
+    size_t file_size = st.st_size;
+    if ( file_size == 0 )
+    {
+      close(fd);
+      return true;
+    }
+    void* addr = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ( addr == MAP_FAILED )
+    {
+      std::cerr << "Can't open vocabulary file: " << filename << std::endl;
+      return false;
+    }
+    bool ok = load_mapped(static_cast<const char*>(addr), file_size, filename);
+    munmap(addr, file_size);
+    return ok;
+#endif
   }
   // получение индекса в словаре по тексту слова
   size_t word_to_idx(const std::string& word) const
@@ -66,12 +97,65 @@ public:
     else
       return it->second;
   }
+  // получение индекса в словаре по атому слова (доступно после build_atom_index)
+  inline size_t atom_to_idx(uint32_t atom) const
+  {
+    if ( atom >= idx_by_atom.size() || idx_by_atom[atom] == INVALID_ATOM_IDX )
+      return std::numeric_limits<size_t>::max();
+    return idx_by_atom[atom];
+  }
+  // построение отображения из атомов в индексы словаря (слова словаря интернируются в глобальной таблице атомов)
+  void build_atom_index()
+  {
+    auto& atom_table = AtomTable::global();
+    idx_by_atom.clear();
+    for (size_t i = 0; i < vocabulary.size(); ++i)
+      set_atom_idx( atom_table.intern(vocabulary[i].word), i );
+  }
   // добавление записи в словарь
   void append(const std::string& word, uint64_t cn)
   {
     vocabulary_hash[word] = vocabulary.size();
+    if ( !idx_by_atom.empty() )
+      set_atom_idx( AtomTable::global().intern(word), vocabulary.size() );
     CustomVocabulary::append(word, cn);
   }
+  // слияние со словарём, построенным по новой порции обучающих данных
+  // частоты известных слов суммируются, новые слова добавляются в конец словаря (индексы известных слов не меняются)
+  void merge(const OriginalWord2VecVocabulary& delta)
+  {
+    const size_t INVALID_IDX = std::numeric_limits<size_t>::max();
+    size_t appended = 0;
+    for (size_t i = 0; i < delta.size(); ++i)
+    {
+      auto& rec = delta.idx_to_data(i);
+      if ( stoplist.find(rec.word) != stoplist.end() )
+        continue;
+      size_t idx = word_to_idx(rec.word);
+      if (idx == INVALID_IDX)
+      {
+        append(rec.word, rec.cn);
+        ++appended;
+      }
+      else
+        vocabulary[idx].cn += rec.cn;
+    }
+    std::cout << "Vocabulary merge: " << appended << " new records" << std::endl;
+  } // method-end
+  // сохранение словаря в файл (в том же формате, в котором он загружается)
+  bool save(const std::string& filename) const
+  {
+    FILE *fo = fopen(filename.c_str(), "wb");
+    if ( fo == nullptr )
+    {
+      std::cerr << "Can't save vocabulary file: " << filename << std::endl;
+      return false;
+    }
+    for (auto& record : vocabulary)
+      fprintf(fo, "%s %lu\n", record.word.c_str(), record.cn);
+    fclose(fo);
+    return true;
+  } // method-end
   // инициализация списка стоп-слов
   void init_stoplist(const std::string& stopwords_filename)
   {
@@ -82,8 +166,118 @@ public:
 
   } // method-end
 private:
+  // наименьший размер порции файла словаря, разбираемой отдельным потоком управления
+  static constexpr size_t MIN_LOAD_CHUNK = 1 << 20;
+  // результат разбора порции файла словаря
+  struct LoadChunk
+  {
+    std::vector<VocabularyData> records;
+    // первая некорректная запись порции (если есть)
+    const char* invalid_begin = nullptr;
+    const char* invalid_end = nullptr;
+  };
+  bool load_mapped(const char* data, size_t size, const std::string& filename)
+  {
+    // разбиение файла на порции по границам строк
+    size_t chunks_count = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), size / MIN_LOAD_CHUNK));
+    std::vector<size_t> bounds(chunks_count + 1, size);
+    bounds[0] = 0;
+    for (size_t c = 1; c < chunks_count; ++c)
+    {
+      size_t pos = std::max(size * c / chunks_count, bounds[c - 1]);
+      const char* nl = (pos < size) ? static_cast<const char*>( std::memchr(data + pos, '\n', size - pos) ) : nullptr;
+      bounds[c] = nl ? (nl - data) + 1 : size;
+    }
+    // параллельный разбор порций
+    std::vector<LoadChunk> chunks(chunks_count);
+    std::vector<std::thread> workers;
+    workers.reserve(chunks_count - 1);
+    for (size_t c = 1; c < chunks_count; ++c)
+      workers.emplace_back(&OriginalWord2VecVocabulary::parse_chunk, this, data + bounds[c], data + bounds[c + 1], std::ref(chunks[c]));
+    parse_chunk(data + bounds[0], data + bounds[1], chunks[0]);
+    for (auto& w : workers)
+      w.join();
+    // слияние порций в порядке их следования в файле
+    size_t records_count = 0;
+    for (auto& chunk : chunks)
+    {
+      if ( chunk.invalid_begin )
+      {
+        std::cerr << "Vocabulary loading error: " << filename << std::endl;
+        std::cerr << "Invalid record: " << std::string(chunk.invalid_begin, chunk.invalid_end) << std::endl;
+        return false;
+      }
+      records_count += chunk.records.size();
+    }
+    vocabulary.reserve(vocabulary.size() + records_count);
+    vocabulary_hash.reserve(vocabulary_hash.size() + records_count);
+    for (auto& chunk : chunks)
+      for (auto& record : chunk.records)
+      {
+        vocabulary_hash[record.word] = vocabulary.size(); // сразу строим хэш-отображение для поиска индекса слова в словаре по слову (строке)
+        vocabulary.push_back( std::move(record) );
+      }
+    return true;
+  } // method-end
+  // разбор порции файла словаря (разбор прекращается на первой некорректной записи)
+  void parse_chunk(const char* begin, const char* end, LoadChunk& chunk) const
+  {
+    std::string word;
+    uint64_t cn = 0;
+    while ( begin < end )
+    {
+      const char* nl = static_cast<const char*>( std::memchr(begin, '\n', end - begin) );
+      const char* line_end = nl ? nl : end;
+      if ( !parse_record(begin, line_end, word, cn) )
+      {
+        chunk.invalid_begin = begin;
+        chunk.invalid_end = line_end;
+        return;
+      }
+      if ( stoplist.find(word) == stoplist.end() )
+        chunk.records.emplace_back(word, cn);
+      begin = line_end + 1;
+    }
+  } // method-end
+  // разбор записи словаря: слово и абсолютная частота встречаемости данного слова в корпусе (на основе которого построен словарь)
+  // элементы словарной записи разделены пробельными символами (пробелы в начале записи не допускаются, в конце -- допускаются)
+  static bool parse_record(const char* begin, const char* end, std::string& word, uint64_t& cn)
+  {
+    auto is_space = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; };
+    const char* word_end = begin;
+    while ( word_end < end && !is_space(*word_end) )
+      ++word_end;
+    const char* cn_begin = word_end;
+    while ( cn_begin < end && is_space(*cn_begin) )
+      ++cn_begin;
+    const char* cn_end = cn_begin;
+    while ( cn_end < end && !is_space(*cn_end) )
+      ++cn_end;
+    const char* tail = cn_end;
+    while ( tail < end && is_space(*tail) )
+      ++tail;
+    if ( word_end == begin || cn_begin == cn_end || tail != end )
+      return false;
+    auto res = std::from_chars(cn_begin, cn_end, cn);
+    if ( res.ec != std::errc() || res.ptr != cn_end )
+      return false;
+    word.assign(begin, word_end);
+    return true;
+  } // method-end
+  void set_atom_idx(uint32_t atom, size_t idx)
+  {
+    if ( atom == AtomTable::INVALID_ATOM )
+      return;
+    if ( atom >= idx_by_atom.size() )
+      idx_by_atom.resize(atom + 1, INVALID_ATOM_IDX);
+    idx_by_atom[atom] = idx;
+  } // method-end
+private:
+  static constexpr uint32_t INVALID_ATOM_IDX = std::numeric_limits<uint32_t>::max();
   // хэш-отображение слов в их индексы в словаре (для быстрого поиска)
   std::unordered_map<std::string, size_t> vocabulary_hash;
+  // отображение атомов слов в их индексы в словаре (плотный массив, индексируемый атомом)
+  std::vector<uint32_t> idx_by_atom;
   // список стоп-слов для словаря (используется при загрузке)
   std::set<std::string> stoplist;
 };
@@ -0,0 +1,48 @@
+#ifndef PHILOX_H_
+#define PHILOX_H_
+
+#include <cstdint>
+
+
+// Счётчиковый генератор случайных чисел Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", 2011).
+// Случайное значение является чистой функцией от ключа и счётчика, поэтому не зависит от порядка обращений
+// (используется для воспроизводимого обучения).
+class Philox
+{
+public:
+  // вычисление блока из четырёх 32-битных случайных чисел
+  static void block(uint64_t key, uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t out[4])
+  {
+    uint32_t k0 = static_cast<uint32_t>(key);
+    uint32_t k1 = static_cast<uint32_t>(key >> 32);
+    for (int r = 0; r < 10; ++r)
+    {
+      uint64_t p0 = static_cast<uint64_t>(0xD2511F53) * c0;
+      uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57) * c2;
+      uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+      uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+      c1 = static_cast<uint32_t>(p1);
+      c3 = static_cast<uint32_t>(p0);
+      c0 = n0;
+      c2 = n2;
+      k0 += 0x9E3779B9;
+      k1 += 0xBB67AE85;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+  } // method-end
+  // 64-битное случайное значение для позиции position в потоке stream
+  static uint64_t at(uint64_t key, uint64_t position, uint32_t stream = 0)
+  {
+    uint32_t out[4];
+    block(key, static_cast<uint32_t>(position), static_cast<uint32_t>(position >> 32), stream, 0, out);
+    return (static_cast<uint64_t>(out[0]) << 32) | out[1];
+  } // method-end
+  // построение ключа по номеру части обучающего множества и номеру эпохи
+  static uint64_t make_key(uint32_t shard, uint32_t epoch)
+  {
+    return (static_cast<uint64_t>(epoch) << 32) | shard;
+  } // method-end
+}; // class-decl-end
+
+
+#endif /* PHILOX_H_ */
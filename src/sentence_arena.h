@@ -0,0 +1,47 @@
+#ifndef SENTENCE_ARENA_H_
+#define SENTENCE_ARENA_H_
+
+#include <memory_resource>
+#include <vector>
+#include <cstddef>
+
+
+// Монотонная арена потока управления для вспомогательных структур, живущих в пределах обработки одного предложения.
+// Память выделяется последовательно из буфера потока и освобождается целиком при сбросе арены,
+// поэтому в установившемся режиме обработка предложения не обращается к глобальному распределителю памяти
+// (глобальный распределитель задействуется, только если буфера не хватило).
+class SentenceArena
+{
+public:
+  static constexpr size_t BUFFER_SIZE = 256 * 1024;
+  // арена текущего потока управления
+  static SentenceArena& local()
+  {
+    thread_local SentenceArena instance;
+    return instance;
+  } // method-end
+  // источник памяти для pmr-контейнеров
+  std::pmr::memory_resource* resource()
+  {
+    return &pool;
+  } // method-end
+  // освобождение всей выделенной памяти (ранее полученные из арены объекты становятся недействительными)
+  void reset()
+  {
+    pool.release();
+  } // method-end
+private:
+  SentenceArena()
+  : buffer(BUFFER_SIZE)
+  , pool(buffer.data(), buffer.size())
+  {
+  }
+  SentenceArena(const SentenceArena&) = delete;
+  SentenceArena& operator=(const SentenceArena&) = delete;
+
+  std::vector<std::byte> buffer;
+  std::pmr::monotonic_buffer_resource pool;
+}; // class-decl-end
+
+
+#endif /* SENTENCE_ARENA_H_ */
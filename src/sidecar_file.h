@@ -0,0 +1,108 @@
+#ifndef SIDECAR_FILE_H_
+#define SIDECAR_FILE_H_
+
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#ifdef _MSC_VER
+  #include <process.h>
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+
+// Общие процедуры двоичных файлов-спутников (кэш индекса шаблонов словосочетаний, кэш встраивания словосочетаний в корпус).
+// Файл состоит из секций, выровненных на 8 байт; записывается во временный файл с последующим переименованием,
+// читается отображением в память. Действительность файла определяется отметкой исходного файла (размер и время модификации).
+// Без поддержки POSIX отметка не вычисляется и файлы-спутники не используются.
+class SidecarFile
+{
+public:
+  // отметка исходного файла (файл-спутник действителен, пока она не изменилась)
+  struct SourceStamp
+  {
+    uint64_t size = 0;
+    int64_t mtime_sec = 0;
+    int64_t mtime_nsec = 0;
+    bool operator==(const SourceStamp& other) const
+    {
+      return size == other.size && mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec;
+    }
+  };
+  static bool source_stamp(const std::string& fn, SourceStamp& stamp)
+  {
+#ifdef _MSC_VER
+    return false;
+#else
+    struct stat st;
+    if ( stat(fn.c_str(), &st) != 0 )
+      return false;
+    stamp.size = st.st_size;
+    stamp.mtime_sec = st.st_mtim.tv_sec;
+    stamp.mtime_nsec = st.st_mtim.tv_nsec;
+    return true;
+#endif
+  } // method-end
+  // имя временного файла для записи (уникально для процесса, чтобы параллельные запуски не писали в один файл)
+  static std::string temp_filename(const std::string& fn)
+  {
+#ifdef _MSC_VER
+    return fn + ".tmp." + std::to_string(_getpid());
+#else
+    return fn + ".tmp." + std::to_string(getpid());
+#endif
+  } // method-end
+  // запись секции с дополнением до границы 8 байт
+  static bool write_section(FILE* f, const void* bytesPtr, size_t bytes)
+  {
+    static const char PADDING[8] = {0};
+    if ( bytes > 0 && fwrite(bytesPtr, 1, bytes, f) != bytes )
+      return false;
+    size_t pad = (8 - bytes % 8) % 8;
+    return pad == 0 || fwrite(PADDING, 1, pad, f) == pad;
+  } // method-end
+  // очередная секция отображённого в память файла (nullptr, если секция выходит за границы файла)
+  template<typename T>
+  static const T* map_section(const char* base, size_t fileSize, size_t& offset, uint64_t count)
+  {
+    if ( offset > fileSize || count > (fileSize - offset) / sizeof(T) )
+      return nullptr;
+    const T* section = reinterpret_cast<const T*>(base + offset);
+    offset += (count * sizeof(T) + 7) / 8 * 8;
+    return section;
+  } // method-end
+  // отображение файла в память только для чтения (nullptr, если файла нет, он короче minSize или отображение невозможно)
+  static const char* map(const std::string& fn, size_t minSize, size_t& fileSize)
+  {
+#ifdef _MSC_VER
+    return nullptr;
+#else
+    int fd = ::open(fn.c_str(), O_RDONLY);
+    if ( fd < 0 )
+      return nullptr;
+    struct stat st;
+    if ( fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < minSize || st.st_size == 0 )
+    {
+      close(fd);
+      return nullptr;
+    }
+    fileSize = st.st_size;
+    void* addr = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return ( addr == MAP_FAILED ) ? nullptr : static_cast<const char*>(addr);
+#endif
+  } // method-end
+  static void unmap(const char* base, size_t fileSize)
+  {
+#ifndef _MSC_VER
+    if ( base )
+      munmap(const_cast<char*>(base), fileSize);
+#endif
+  } // method-end
+}; // class-decl-end
+
+
+#endif /* SIDECAR_FILE_H_ */
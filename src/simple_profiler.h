@@ -3,6 +3,9 @@
 
 #include <chrono>
 #include <iostream>
+#ifndef _MSC_VER
+  #include <sys/resource.h>
+#endif
 
 
 class SimpleProfiler
@@ -19,6 +22,11 @@ public:
 //    std::cout << std::fixed << "  time elapsed: " << ms.count() << " ms" << std::endl;
     std::chrono::duration< double, std::ratio<1> > seconds = finish_tp - start_tp;
     std::cout << std::fixed << "  time elapsed: " << seconds.count() << " seconds" << std::endl;
+#ifndef _MSC_VER
+    struct rusage usage;
+    if ( getrusage(RUSAGE_SELF, &usage) == 0 )
+      std::cout << "  peak RSS: " << (usage.ru_maxrss / 1024) << " MB" << std::endl;  // в linux ru_maxrss измеряется в килобайтах
+#endif
   }
 private:
   std::chrono::steady_clock::time_point start_tp;
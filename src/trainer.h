@@ -5,6 +5,8 @@
 #include "vocabulary.h"
 #include "original_word2vec_vocabulary.h"
 #include "vectors_model.h"
+#include "philox.h"
+#include "collapsing_plan.h"
 //#include "tracer.h"
 
 #include <memory>
@@ -12,6 +14,9 @@
 #include <chrono>
 #include <iostream>
 #include <fstream>
+#include <unordered_map>
+#include <thread>
+#include <algorithm>
 
 #ifdef _MSC_VER
   #define posix_memalign(p, a, s) (((*(p)) = _aligned_malloc((s), (a))), *(p) ? 0 : errno)
@@ -55,6 +60,7 @@ public:
   , alpha(learning_rate)
   , starting_alpha(learning_rate)
   , negative(negative_count)
+  , threads_count(total_threads_count)
   {
     // предварительный табличный расчет для логистической функции
     expTable = (float *)malloc((EXP_TABLE_SIZE + 1) * sizeof(float));
@@ -63,11 +69,7 @@ public:
       expTable[i] = expTable[i] / (expTable[i] + 1);                         // Precompute f(x) = x / (x + 1)
     }
     // запомним количество обучающих примеров
-    train_words = w_vocabulary->cn_sum();
-    // настроим периодичность обновления "коэффициента скорости обучения"
-    alpha_chunk = (train_words - 1) / total_threads_count;
-    if (alpha_chunk > 10000)
-      alpha_chunk = 10000;
+    set_train_words( w_vocabulary->cn_sum() );
     // инициализируем распределения, имитирующие шум (для словарей контекстов)
     if ( dep_ctx_vocabulary )
       InitUnigramTable(table_dep, dep_ctx_vocabulary);
@@ -87,6 +89,15 @@ public:
     if (table_dep)
       free(table_dep);
   }
+  // переопределение количества обучающих примеров (при дообучении словарь содержит частоты по всем порциям данных)
+  void set_train_words(uint64_t trainWords)
+  {
+    train_words = trainWords;
+    // настроим периодичность обновления "коэффициента скорости обучения"
+    alpha_chunk = (train_words - 1) / threads_count;
+    if (alpha_chunk > 10000)
+      alpha_chunk = 10000;
+  } // method-end
   // функция создания весовых матриц нейросети
   void create_net()
   {
@@ -165,19 +176,7 @@ public:
         {
           word_count_actual += (word_count - last_word_count);
           last_word_count = word_count;
-          fraction = word_count_actual / (float)(epoch_count * train_words + 1);
-          //if ( debug_mode != 0 )
-          {
-            std::chrono::steady_clock::time_point current_learning_tp = std::chrono::steady_clock::now();
-            std::chrono::duration< double, std::ratio<1> > learning_seconds = current_learning_tp - start_learning_tp;
-            printf( "\rAlpha: %f  Progress: %.2f%%  Words/sec: %.2fk   ", alpha,
-                    fraction * 100,
-                    word_count_actual / (learning_seconds.count() * 1000) );
-            fflush(stdout);
-          }
-          alpha = starting_alpha * (1.0 - fraction);
-          if ( alpha < starting_alpha * 0.0001 )
-            alpha = starting_alpha * 0.0001;
+          update_progress();
         } // if ('checkpoint')
         // читаем очередной обучающий пример
         auto learning_example = lep->get(thread_idx);
@@ -192,17 +191,112 @@ public:
     } // for all epochs
     free(neu1e);
   } // method-end: train_entry_point
+  // подготовка потокового режима обучения (вызывается однократно до запуска потоков)
+  bool stream_prepare()
+  {
+    return lep->stream_start(epoch_count);
+  } // method-end
+  // процедура обучения в потоковом режиме (точка входа для потоков)
+  // эпохи не разделяются: поток обрабатывает порции обучающего множества, пока они не закончатся во всех эпохах,
+  // а скорость обучения определяется общим прогрессом
+  void train_stream_entry_point( size_t thread_idx )
+  {
+    unsigned long long next_random_ns = thread_idx;
+    if ( !lep->stream_prepare(thread_idx) )
+      return;
+    float *neu1e = (float *)calloc(layer1_size, sizeof(float));
+    long long word_count = 0, last_word_count = 0;
+    while (true)
+    {
+      if (word_count - last_word_count > alpha_chunk)
+      {
+        word_count_actual += (word_count - last_word_count);
+        last_word_count = word_count;
+        update_progress();
+      }
+      auto learning_example = lep->get(thread_idx);
+      word_count = lep->getWordsCount(thread_idx);
+      if (!learning_example) break; // все порции всех эпох обработаны
+      skip_gram( learning_example.value(), neu1e, next_random_ns );
+    }
+    word_count_actual += (word_count - last_word_count);
+    lep->stream_unprepare(thread_idx);
+    free(neu1e);
+  } // method-end: train_stream_entry_point
+  // воспроизводимая процедура обучения (выполняется в одном потоке управления)
+  // обучающее множество делится на те же части, что и при многопоточном обучении; обучающие примеры выбираются из частей поочерёдно;
+  // случайные величины для negative sampling вычисляются по номеру части, номеру эпохи и позиции примера в части
+  void train_deterministic()
+  {
+    size_t shards_count = threads_count;
+    float *neu1e = (float *)calloc(layer1_size, sizeof(float));
+    std::vector<long long> word_count(shards_count), last_word_count(shards_count);
+    std::vector<uint64_t> example_no(shards_count);
+    std::vector<bool> active(shards_count);
+    for (size_t epochIdx = 0; epochIdx < epoch_count; ++epochIdx)
+    {
+      for (size_t s = 0; s < shards_count; ++s)
+      {
+        if ( !lep->epoch_prepare(s) )
+        {
+          free(neu1e);
+          return;
+        }
+        word_count[s] = last_word_count[s] = 0;
+        example_no[s] = 0;
+        active[s] = true;
+      }
+      size_t active_count = shards_count;
+      while (active_count > 0)
+      {
+        for (size_t s = 0; s < shards_count; ++s)
+        {
+          if ( !active[s] ) continue;
+          if (word_count[s] - last_word_count[s] > alpha_chunk)
+          {
+            word_count_actual += (word_count[s] - last_word_count[s]);
+            last_word_count[s] = word_count[s];
+            update_progress();
+          }
+          auto learning_example = lep->get(s);
+          word_count[s] = lep->getWordsCount(s);
+          if (!learning_example)
+          {
+            active[s] = false;
+            --active_count;
+            continue;
+          }
+          unsigned long long next_random_ns = Philox::at( Philox::make_key(s, epochIdx), example_no[s]++, 1 );
+          skip_gram( learning_example.value(), neu1e, next_random_ns );
+        }
+      }
+      for (size_t s = 0; s < shards_count; ++s)
+      {
+        word_count_actual += (word_count[s] - last_word_count[s]);
+        if ( !lep->epoch_unprepare(s) )
+        {
+          free(neu1e);
+          return;
+        }
+      }
+    } // for all epochs
+    free(neu1e);
+  } // method-end: train_deterministic
   // функция, реализующая сохранение эмбеддингов
-  void saveEmbeddings(const std::string& filename, bool useTxtFmt = false) const
+  // (строки, отмеченные в droppedRows, в модель не попадают; словарь и матрица при этом не изменяются)
+  void saveEmbeddings(const std::string& filename, bool useTxtFmt = false, const std::vector<bool>* droppedRows = nullptr) const
   {
 //    if (tracer)
 //      tracer->save(w_vocabulary);
     FILE *fo = fopen(filename.c_str(), "wb");
-    fprintf(fo, "%lu %lu\n", w_vocabulary->size(), layer1_size);
+    size_t rows_count = w_vocabulary->size();
+    if (droppedRows)
+      rows_count -= std::count(droppedRows->begin(), droppedRows->end(), true);
+    fprintf(fo, "%lu %lu\n", rows_count, layer1_size);
     if ( !useTxtFmt )
-      saveEmbeddingsBin_helper(fo, w_vocabulary, syn0, layer1_size);
+      saveEmbeddingsBin_helper(fo, w_vocabulary, syn0, layer1_size, droppedRows);
     else
-      saveEmbeddingsTxt_helper(fo, w_vocabulary, syn0, layer1_size);
+      saveEmbeddingsTxt_helper(fo, w_vocabulary, syn0, layer1_size, droppedRows);
     fclose(fo);
   } // method-end
   // функция добавления эмбеддингов в уже существующую модель
@@ -225,15 +319,11 @@ public:
     fclose(fo);
   } // method-end
   // функция сохранения весовых матриц в файл
+  // первой записывается матрица между скрытым и выходным слоем, за ней (при left == true) -- матрица между входным и скрытым слоем,
+  // поэтому файл, сохранённый с left == true, восстанавливается и без левой матрицы
   void backup(const std::string& filename, bool left = true, bool right= true) const
   {
     FILE *fo = fopen(filename.c_str(), "wb");
-    // сохраняем весовую матрицу между входным и скрытым слоем
-    if (left)
-    {
-      fprintf(fo, "%lu %lu\n", w_vocabulary->size(), layer1_size);
-      saveEmbeddingsBin_helper(fo, w_vocabulary, syn0, layer1_size);
-    }
     // сохраняем весовые матрицы между скрытым и выходным слоем
     if (right)
     {
@@ -243,10 +333,18 @@ public:
         saveEmbeddingsBin_helper(fo, dep_ctx_vocabulary, syn1_dep, size_dep);
       }
     }
+    // сохраняем весовую матрицу между входным и скрытым слоем
+    if (left)
+    {
+      fprintf(fo, "%lu %lu\n", w_vocabulary->size(), layer1_size);
+      saveEmbeddingsBin_helper(fo, w_vocabulary, syn0, layer1_size);
+    }
     fclose(fo);
   } // method-end
-  // функция восстановления весовых матриц из файла (предполагает, что память уже выделена)
-  bool restore(const std::string& filename, bool left = true, bool right= true)
+  // функция восстановления весовых матриц из файла (предполагает, что память уже выделена, а файл сохранён с right == true)
+  // при byWords == true строки матриц сопоставляются по словам, а не по позициям
+  // (словарь мог быть расширен при дообучении; строки новых слов сохраняют начальную инициализацию)
+  bool restore(const std::string& filename, bool left = true, bool right= true, bool byWords = false)
   {
     // открываем файл модели
     std::ifstream ifs(filename.c_str(), std::ios::binary);
@@ -255,37 +353,50 @@ public:
       std::cerr << "Restore: Backup file not found" << std::endl;
       return false;
     }
-    // загружаем матрицу между входным и скрытым слоем
-    if (left)
+    // загружаем (или пропускаем, если она не нужна) матрицу между скрытым и выходным слоем
+    if ( dep_ctx_vocabulary && (right || left) )
     {
       size_t vocab_size, emb_size;
       restore__read_sizes(ifs, vocab_size, emb_size);
-      if (vocab_size != w_vocabulary->size() || emb_size != layer1_size)
+      if ((!byWords && vocab_size != dep_ctx_vocabulary->size()) || emb_size != size_dep)
       {
         std::cerr << "Restore: Dimensions fail" << std::endl;
         return false;
       }
-      if ( !restore__read_matrix(ifs, w_vocabulary, layer1_size, syn0) )
+      if ( !right )
+        restore__skip_matrix(ifs, vocab_size, emb_size);
+      else if ( byWords )
+        restore__read_matrix_by_words(ifs, vocab_size, dep_ctx_vocabulary, size_dep, syn1_dep);
+      else if ( !restore__read_matrix(ifs, dep_ctx_vocabulary, size_dep, syn1_dep) )
         return false;
     }
-    // загружаем матрицы между скрытым и выходным слоем
-    if (right)
+    // загружаем матрицу между входным и скрытым слоем
+    if (left)
     {
-      size_t vocab_size, emb_size;
+      size_t vocab_size = 0, emb_size = 0;
       restore__read_sizes(ifs, vocab_size, emb_size);
-      if (vocab_size != dep_ctx_vocabulary->size() || emb_size != size_dep)
+      if ( !ifs.good() )
+      {
+        std::cerr << "Restore: Backup contains no input-hidden matrix (it was saved without one)" << std::endl;
+        return false;
+      }
+      if ((!byWords && vocab_size != w_vocabulary->size()) || emb_size != layer1_size)
       {
         std::cerr << "Restore: Dimensions fail" << std::endl;
         return false;
       }
-      if ( !restore__read_matrix(ifs, dep_ctx_vocabulary, size_dep, syn1_dep) )
+      if ( byWords )
+        restore__read_matrix_by_words(ifs, vocab_size, w_vocabulary, layer1_size, syn0);
+      else if ( !restore__read_matrix(ifs, w_vocabulary, layer1_size, syn0) )
         return false;
     }
     start_learning_tp = std::chrono::steady_clock::now();
     return true;
   } // method-end
   // функция восстановления ассоциативной весовой матрицы по векторной модели
-  bool restore_assoc_by_model(const VectorsModel& vm)
+  // строки, отмеченные в absentRows (временные словосочетания, не записываемые в модель), могут в модели отсутствовать
+  // и сохраняют начальную инициализацию
+  bool restore_assoc_by_model(const VectorsModel& vm, const std::vector<bool>* absentRows = nullptr)
   {
     if (!assoc_ctx_vocabulary)
       return true;
@@ -295,6 +406,8 @@ public:
       size_t w_idx = vm.get_word_idx(aword);
       if (w_idx == vm.words_count)
       {
+        if ( absentRows && (*absentRows)[a] )
+          continue;
         std::cerr << "restore_assoc_by_model: vocabs inconsistency" << std::endl;
         return false;
       }
@@ -312,42 +425,65 @@ public:
       std::cerr << "restore_left_matrix: dimensions discrepancy" << std::endl;
       return false;
     }
+    // индекс слов модели (линейный поиск get_word_idx для каждого слова словаря слишком дорог на больших словарях)
+    std::unordered_map<std::string, size_t> vm_index;
+    vm_index.reserve(vm.vocab.size());
+    for (size_t i = 0; i < vm.vocab.size(); ++i)
+      vm_index.emplace(vm.vocab[i], i);
     for (size_t w = 0; w < w_vocabulary->size(); ++w)
     {
       auto& voc_rec = w_vocabulary->idx_to_data(w);
-      size_t vm_idx = vm.get_word_idx( voc_rec.word );
-      if (vm_idx == vm.words_count) // вектора неизвестных слов остаются случайно-инициализированными
+      auto vm_it = vm_index.find( voc_rec.word );
+      if (vm_it == vm_index.end()) // вектора неизвестных слов остаются случайно-инициализированными
       {
         //std::cerr << "warning: vector representation random init: " << voc_rec.word << std::endl;
         continue;
       }
+      size_t vm_idx = vm_it->second;
       float* hereOffset  = syn0 + w * layer1_size;
       float* thereOffset = vm.embeddings + vm_idx * vm.emb_size;
       std::copy(thereOffset, thereOffset + vm.emb_size, hereOffset);
     }
     return true;
   } // method-end
-  // функция усреднения векторов в векторном пространстве в соотвесттвии с заданным списком
-  // усреденный вектор записывается по идексу, соответствующему первому элементу списка
-  void vectors_weighted_collapsing(const std::vector< std::vector< std::pair<size_t, float> > >& collapsing_info)
+  // функция усреднения векторов в векторном пространстве в соответствии с планом (см. CollapsingPlan)
+  // группы обрабатываются параллельно (threads_count потоков, непрерывными диапазонами групп);
+  // все средние вычисляются по исходным векторам во временный буфер и лишь затем записываются по целевым индексам,
+  // поэтому результат не зависит ни от порядка групп, ни от распределения их по потокам
+  void vectors_weighted_collapsing(const CollapsingPlan& plan)
   {
-    // выделение памяти для среднего вектора
-    float *avg = (float *)calloc(layer1_size, sizeof(float));
-    for (auto& group : collapsing_info)
+    size_t groups_count = plan.groups_count();
+    if ( groups_count == 0 )
+      return;
+    std::vector<float> averages(groups_count * layer1_size);
+    auto worker = [this, &plan, &averages, groups_count](size_t tIdx, size_t tCount)
     {
-      std::fill(avg, avg+layer1_size, 0.0);
-      for (auto& vec : group)
+      size_t g_begin = groups_count * tIdx / tCount;
+      size_t g_end = groups_count * (tIdx + 1) / tCount;
+      // вычисление средних
+      for (size_t g = g_begin; g < g_end; ++g)
       {
-        size_t idx = vec.first;
-        float weight = vec.second;
-        float *offset = syn0 + idx*layer1_size;
-        for (size_t d = 0; d < layer1_size; ++d)
-          *(avg+d) += *(offset+d) * weight;
+        float* __restrict avg = averages.data() + g * layer1_size;
+        for (size_t pos = plan.group_begin(g); pos < plan.group_end(g); ++pos)
+        {
+          const float* __restrict src = syn0 + plan.source(pos) * layer1_size;
+          float weight = plan.weight(pos);
+          for (size_t d = 0; d < layer1_size; ++d)
+            avg[d] += src[d] * weight;
+        }
       }
-      float *offset = syn0 + group.front().first * layer1_size;
-      std::copy(avg, avg+layer1_size, offset);
-    }
-    free(avg);
+    };
+    size_t tCount = std::max<size_t>(1, std::min(threads_count, groups_count));
+    std::vector<std::thread> workers;
+    workers.reserve(tCount - 1);
+    for (size_t t = 1; t < tCount; ++t)
+      workers.emplace_back(worker, t, tCount);
+    worker(0, tCount);
+    for (auto& w : workers)
+      w.join();
+    // запись средних по целевым индексам
+    for (size_t g = 0; g < groups_count; ++g)
+      std::copy(averages.data() + g * layer1_size, averages.data() + (g + 1) * layer1_size, syn0 + plan.target(g) * layer1_size);
   } // method-end
 
 private:
@@ -371,6 +507,8 @@ private:
   float starting_alpha;
   // количество отрицательных примеров на каждый положительный при оптимизации методом negative sampling
   size_t negative;
+  // количество потоков управления (частей обучающего множества)
+  size_t threads_count;
   // матрицы весов между слоями input-hidden и hidden-output
   float *syn0 = nullptr, *syn1_dep = nullptr, *syn1_assoc = nullptr;
   // табличное представление логистической функции в области определения [-MAX_EXP; +MAX_EXP]
@@ -472,6 +610,7 @@ private:
     {
       for (auto&& ctx_idx : le.assoc_context)
       {
+        if ( ctx_idx == le.word ) continue;  // текущее слово не считаем себе ассоциативным
         for (size_t d = 0; d <= negative; ++d)
         {
           if (d == 0) // на первой итерации рассматриваем положительный пример (контекст)
@@ -505,6 +644,7 @@ private:
     {
       for (auto&& ctx_idx : le.assoc_context)
       {
+        if ( ctx_idx == le.word ) continue;  // текущее слово не считаем себе ассоциативным
         float *ctxVectorPtr = syn1_assoc + ctx_idx * size_assoc;
         float f = std::inner_product(targetVectorPtr, targetVectorPtr+size_assoc, ctxVectorPtr, 0.0);
         if ( std::isnan(f) ) continue;
@@ -515,6 +655,23 @@ private:
     }
   } // method-end
 
+  // вывод прогресс-сообщения и корректировка коэффициента скорости обучения (alpha)
+  void update_progress()
+  {
+    fraction = word_count_actual / (float)(epoch_count * train_words + 1);
+    //if ( debug_mode != 0 )
+    {
+      std::chrono::steady_clock::time_point current_learning_tp = std::chrono::steady_clock::now();
+      std::chrono::duration< double, std::ratio<1> > learning_seconds = current_learning_tp - start_learning_tp;
+      printf( "\rAlpha: %f  Progress: %.2f%%  Words/sec: %.2fk   ", alpha,
+              fraction * 100,
+              word_count_actual / (learning_seconds.count() * 1000) );
+      fflush(stdout);
+    }
+    alpha = starting_alpha * (1.0 - fraction);
+    if ( alpha < starting_alpha * 0.0001 )
+      alpha = starting_alpha * 0.0001;
+  } // method-end
   // вычисление значения сигмоиды
   inline float sigmoid(float f) const
   {
@@ -532,15 +689,18 @@ private:
   std::chrono::steady_clock::time_point start_learning_tp;
 //  std::shared_ptr<Tracer> tracer;
 
-  void saveEmbeddingsBin_helper(FILE *fo, std::shared_ptr< CustomVocabulary > vocabulary, float *weight_matrix, size_t emb_size) const
+  // запись строк весовой матрицы (строки, отмеченные в droppedRows, пропускаются)
+  void saveEmbeddingsBin_helper(FILE *fo, std::shared_ptr< CustomVocabulary > vocabulary, float *weight_matrix, size_t emb_size, const std::vector<bool>* droppedRows = nullptr) const
   {
     for (size_t a = 0; a < vocabulary->size(); ++a)
-      VectorsModel::write_embedding(fo, false, vocabulary->idx_to_data(a).word, &weight_matrix[a * emb_size], emb_size);
+      if ( !droppedRows || !(*droppedRows)[a] )
+        VectorsModel::write_embedding(fo, false, vocabulary->idx_to_data(a).word, &weight_matrix[a * emb_size], emb_size);
   } // method-end
-  void saveEmbeddingsTxt_helper(FILE *fo, std::shared_ptr< CustomVocabulary > vocabulary, float *weight_matrix, size_t emb_size) const
+  void saveEmbeddingsTxt_helper(FILE *fo, std::shared_ptr< CustomVocabulary > vocabulary, float *weight_matrix, size_t emb_size, const std::vector<bool>* droppedRows = nullptr) const
   {
     for (size_t a = 0; a < vocabulary->size(); ++a)
-      VectorsModel::write_embedding(fo, true, vocabulary->idx_to_data(a).word, &weight_matrix[a * emb_size], emb_size);
+      if ( !droppedRows || !(*droppedRows)[a] )
+        VectorsModel::write_embedding(fo, true, vocabulary->idx_to_data(a).word, &weight_matrix[a * emb_size], emb_size);
   } // method-end
   void restore__read_sizes(std::ifstream& ifs, size_t& vocab_size, size_t& emb_size)
   {
@@ -549,6 +709,16 @@ private:
     ifs >> emb_size;
     std::getline(ifs,buf); // считываем конец строки
   } // method-end
+  void restore__skip_matrix(std::ifstream& ifs, size_t rows_count, size_t emb_size)
+  {
+    std::string buf;
+    for (size_t i = 0; i < rows_count; ++i)
+    {
+      std::getline(ifs, buf, ' '); // пропускаем слово (до пробела)
+      ifs.ignore( sizeof(float)*emb_size );
+      std::getline(ifs,buf); // считываем конец строки
+    }
+  } // method-end
   bool restore__read_matrix(std::ifstream& ifs, std::shared_ptr< CustomVocabulary > vocab, size_t emb_size, float *matrix)
   {
     std::string buf;
@@ -567,6 +737,24 @@ private:
     }
     return true;
   } // method-end
+  void restore__read_matrix_by_words(std::ifstream& ifs, size_t rows_count, std::shared_ptr< CustomVocabulary > vocab, size_t emb_size, float *matrix)
+  {
+    const size_t INVALID_IDX = std::numeric_limits<size_t>::max();
+    std::string buf;
+    std::vector<float> skipped(emb_size);
+    size_t restored = 0;
+    for (size_t i = 0; i < rows_count; ++i)
+    {
+      std::getline(ifs, buf, ' '); // читаем слово (до пробела)
+      size_t idx = vocab->word_to_idx(buf);
+      float* eOffset = (idx == INVALID_IDX) ? skipped.data() : matrix + idx*emb_size;
+      ifs.read( reinterpret_cast<char*>( eOffset ), sizeof(float)*emb_size );
+      std::getline(ifs,buf); // считываем конец строки
+      if (idx != INVALID_IDX)
+        ++restored;
+    }
+    std::cout << "Restore: " << restored << " of " << vocab->size() << " rows restored" << std::endl;
+  } // method-end
 }; // class-decl-end
 
 
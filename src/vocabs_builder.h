@@ -3,13 +3,16 @@
 
 #include "conll_reader.h"
 #include "mwe_vocabulary.h"
+#include "mwe_substitution_cache.h"
 #include "original_word2vec_vocabulary.h"
+#include "atom_table.h"
 
 #include <memory>
 #include <string>
 #include <cstring>       // for std::strerror
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <set>
 #include <fstream>
 
@@ -53,26 +56,59 @@ private:
 };
 
 
+// Частотный словарь, индексированный атомами (см. AtomTable)
+class AtomCounts
+{
+public:
+  inline void inc(uint32_t atom)
+  {
+    if ( atom >= counts.size() )
+      counts.resize( std::max<size_t>(atom + 1, counts.size() * 2), 0 );
+    ++counts[atom];
+  }
+  // преобразование в строковое отображение (для сохранения)
+  std::shared_ptr< std::unordered_map<std::string, uint64_t> > to_mapping() const
+  {
+    auto& atom_table = AtomTable::global();
+    auto result = std::make_shared< std::unordered_map<std::string, uint64_t> >();
+    for (size_t atom = 0; atom < counts.size(); ++atom)
+      if ( counts[atom] > 0 )
+        (*result)[ atom_table.str(atom) ] = counts[atom];
+    return result;
+  }
+private:
+  std::vector<uint64_t> counts;
+};
+
+
 // Класс, обеспечивающие создание словарей (-task vocab)
 class VocabsBuilder
 {
 private:
-  typedef std::vector< std::vector<std::string> > SentenceMatrix;
+  typedef ConllSentence SentenceMatrix;
   typedef std::unordered_map<std::string, uint64_t> VocabMapping;
   typedef std::shared_ptr<VocabMapping> VocabMappingPtr;
   typedef std::unordered_map<std::string, std::map<std::string, size_t>> Token2LemmasMap;
   typedef std::shared_ptr<Token2LemmasMap> Token2LemmasMapPtr;
+  typedef std::unordered_map<uint32_t, std::unordered_map<uint32_t, size_t>> AtomToken2LemmasMap;
+  // счётчик синтаксических контекстов по составному ключу (атом слова, атом типа связи, направление)
+  typedef std::unordered_map<uint64_t, uint64_t> DepCtxCounts;
+  // атомы служебных значений conll
+  uint32_t atom_punc = AtomTable::INVALID_ATOM;
+  uint32_t atom_none = AtomTable::INVALID_ATOM;
+  // атомы лемм-знаков препинания (для apply_patches)
+  std::unordered_set<uint32_t> punct_atoms;
 public:
   // построение всех словарей
   bool build_vocabs(const std::string& conll_fn, const std::string& mwe_fn,
                     const std::string& voc_m_fn, const std::string& voc_p_fn, const std::string& voc_t_fn,
                     const std::string& voc_tm_fn, const std::string& voc_d_fn,
                     size_t limit_m, size_t limit_p, size_t limit_t, size_t limit_d,
-                    size_t ctx_vocabulary_column_d, bool use_deprel)
+                    size_t ctx_vocabulary_column_d, bool use_deprel, bool use_mwe_cache = false)
   {
     // Проход 1: строим главный словарь (включая словосочетания)
 
-    bool succ = build_main_vocab_only(conll_fn, mwe_fn, voc_m_fn, limit_m);
+    bool succ = build_main_vocab_only(conll_fn, mwe_fn, voc_m_fn, limit_m, use_mwe_cache);
     if ( !succ ) return false;
 
     // Проход2: строим остальные словари уже с учётом того, какие именно словосочетания преодолели частотный порог основного словаря
@@ -84,6 +120,10 @@ public:
     std::shared_ptr< MweVocabulary > v_mwe = std::make_shared<MweVocabulary>();
     if ( !v_mwe->load(mwe_fn, v_main) )
       return false;
+    // кэш встраивания словосочетаний (отфильтрованных по главному словарю) используется и при обучении
+    MweSubstitutionCache mwe_cache;
+    if ( use_mwe_cache )
+      mwe_cache.open(conll_fn, *v_mwe, true);
 
     // открываем файл с тренировочными данными
     FILE *conll_file = fopen(conll_fn.c_str(), "rb");
@@ -93,11 +133,12 @@ public:
       return false;
     }
 
-    // создаем контейнеры для словарей
-    VocabMappingPtr vocab_lemma_proper = std::make_shared<VocabMapping>();
-    VocabMappingPtr vocab_token = std::make_shared<VocabMapping>();
-    Token2LemmasMapPtr token2lemmas_map = std::make_shared<Token2LemmasMap>();
-    VocabMappingPtr vocab_dep = std::make_shared<VocabMapping>();
+    // создаем контейнеры для словарей (частоты накапливаются по атомам)
+    AtomCounts vocab_lemma_proper;
+    AtomCounts vocab_token;
+    AtomToken2LemmasMap token2lemmas_map;
+    DepCtxCounts vocab_dep_deprel;
+    AtomCounts vocab_dep;
 
     // в цикле читаем предложения из CoNLL-файла и извлекаем из них информацию для словарей
     SentenceMatrix sentence_matrix;
@@ -105,6 +146,7 @@ public:
     StatHelper stat;
     while ( !feof(conll_file) )
     {
+      uint64_t sentence_offset = ftell(conll_file);
       bool succ = ConllReader::read_sentence(conll_file, sentence_matrix);
       stat.calc_sentence(sentence_matrix.size());
       if (!succ)
@@ -115,33 +157,38 @@ public:
       if (sentence_matrix.size() == 0)
         continue;
       apply_patches(sentence_matrix); // todo: УБРАТЬ!  временный дополнительный корректор для борьбы с "грязными данными" в результатах лемматизации
-      v_mwe->put_phrases_into_sentence(sentence_matrix);
+      mwe_cache.substitute(*v_mwe, sentence_matrix, sentence_offset);
       process_sentence_lemmas_proper(vocab_lemma_proper, sentence_matrix);
       process_sentence_tokens(vocab_token, token2lemmas_map, sentence_matrix);
-      process_sentence_dep_ctx(vocab_dep, sentence_matrix, ctx_vocabulary_column_d, use_deprel);
+      process_sentence_dep_ctx(vocab_dep_deprel, vocab_dep, sentence_matrix, ctx_vocabulary_column_d, use_deprel);
     }
     fclose(conll_file);
     std::cout << std::endl;
     stat.output_stat();
+    mwe_cache.save();
+    v_mwe->report_match_stats(std::cout);
 
     // сохраняем словари в файлах
     std::cout << "Save lemmas proper-names vocabulary..." << std::endl;
-    save_vocab(vocab_lemma_proper, limit_p, voc_p_fn);
+    save_vocab(vocab_lemma_proper.to_mapping(), limit_p, voc_p_fn);
     std::cout << "Save tokens vocabulary..." << std::endl;
-    save_vocab(vocab_token, limit_t, voc_t_fn, token2lemmas_map, voc_tm_fn);
+    save_vocab(vocab_token.to_mapping(), limit_t, voc_t_fn, token2lemmas_to_mapping(token2lemmas_map), voc_tm_fn);
     std::cout << "Save dependency contexts vocabulary..." << std::endl;
-    save_vocab(vocab_dep, limit_d, voc_d_fn);
+    save_vocab(use_deprel ? dep_ctx_to_mapping(vocab_dep_deprel) : vocab_dep.to_mapping(), limit_d, voc_d_fn);
     return true;
   } // method-end
 private:
   // функция построения и сохранения главного словаря
   // выполняется отдельно, т.к. необходимо выяснить частоты словосочетаний (какие из них преодолевают частотный порог главного словаря и будут преобразовываться)
-  bool build_main_vocab_only(const std::string& conll_fn, const std::string& mwe_fn, const std::string& voc_m_fn, size_t limit_m)
+  bool build_main_vocab_only(const std::string& conll_fn, const std::string& mwe_fn, const std::string& voc_m_fn, size_t limit_m, bool use_mwe_cache)
   {
     // создаём справочник словосочетаний
     std::shared_ptr< MweVocabulary > v_mwe = std::make_shared<MweVocabulary>();
     if ( !v_mwe->load(mwe_fn) )
       return false;
+    MweSubstitutionCache mwe_cache;
+    if ( use_mwe_cache )
+      mwe_cache.open(conll_fn, *v_mwe, true);
     // открываем файл с тренировочными данными
     FILE *conll_file = fopen(conll_fn.c_str(), "rb");
     if ( conll_file == nullptr )
@@ -149,14 +196,15 @@ private:
       std::cerr << "Train-file open: error: " << std::strerror(errno) << std::endl;
       return false;
     }
-    // создаем контейнер для словаря
-    VocabMappingPtr vocab_lemma_main = std::make_shared<VocabMapping>();
+    // создаем контейнер для словаря (частоты накапливаются по атомам)
+    AtomCounts vocab_lemma_main;
     // в цикле читаем предложения из CoNLL-файла и извлекаем из них информацию для словаря
     SentenceMatrix sentence_matrix;
     sentence_matrix.reserve(5000);
     StatHelper stat;
     while ( !feof(conll_file) )
     {
+      uint64_t sentence_offset = ftell(conll_file);
       bool succ = ConllReader::read_sentence(conll_file, sentence_matrix);
       stat.calc_sentence(sentence_matrix.size());
       if (!succ)
@@ -167,16 +215,19 @@ private:
       if (sentence_matrix.size() == 0)
         continue;
       apply_patches(sentence_matrix); // todo: УБРАТЬ!  временный дополнительный корректор для борьбы с "грязными данными" в результатах лемматизации
-      v_mwe->put_phrases_into_sentence(sentence_matrix);
+      mwe_cache.substitute(*v_mwe, sentence_matrix, sentence_offset);
       process_sentence_lemmas_main(vocab_lemma_main, sentence_matrix);
     }
     fclose(conll_file);
     std::cout << std::endl;
     stat.output_stat();
+    mwe_cache.save();
+    v_mwe->report_match_stats(std::cout);
     // сохраняем словарь в файл
     std::cout << "Save lemmas main vocabulary..." << std::endl;
-    erase_main_stopwords(vocab_lemma_main); // todo: УБРАТЬ!  временный дополнительный фильтр для борьбы с "грязными данными" в результатах морфологического анализа
-    save_vocab(vocab_lemma_main, limit_m, voc_m_fn);
+    auto vocab_lemma_main_mapping = vocab_lemma_main.to_mapping();
+    erase_main_stopwords(vocab_lemma_main_mapping); // todo: УБРАТЬ!  временный дополнительный фильтр для борьбы с "грязными данными" в результатах морфологического анализа
+    save_vocab(vocab_lemma_main_mapping, limit_m, voc_m_fn);
     return true;
   } // method-end
   // проверка, является ли токен собственным именем
@@ -209,133 +260,139 @@ private:
   }
   void apply_patches(SentenceMatrix& sentence)
   {
-    for ( auto& token : sentence )
-      if ( is_punct__patch(token[2]) )
-        token[7] = "PUNC";
+    init_atoms();
+    for (size_t i = 0; i < sentence.size(); ++i)
+      if ( punct_atoms.find(sentence.atom(i, 2)) != punct_atoms.end() )
+        sentence.set_field(i, 7, "PUNC", atom_punc);
+  }
+  // интернирование служебных значений (однократно)
+  void init_atoms()
+  {
+    if ( atom_punc != AtomTable::INVALID_ATOM )
+      return;
+    auto& atom_table = AtomTable::global();
+    atom_punc = atom_table.intern("PUNC");
+    atom_none = atom_table.intern("_");
+    for (auto& p : puncts())
+      punct_atoms.insert( atom_table.intern(p) );
   }
-  void process_sentence_lemmas_main(VocabMappingPtr vocab, const SentenceMatrix& sentence)
+  void process_sentence_lemmas_main(AtomCounts& vocab, const SentenceMatrix& sentence)
   {
-    for ( auto& token : sentence )
+    for (size_t i = 0; i < sentence.size(); ++i)
     {
-      if (token[7] == "PUNC")  // знаки препинания в основной словарь не включаем (они обрабатываются особо)
+      if (sentence.atom(i, 7) == atom_punc)  // знаки препинания в основной словарь не включаем (они обрабатываются особо)
         continue;
-      if ( isProperName(token[5]) )
+      if ( isProperName(sentence[i][5]) )
         continue;
-      if ( token[2] == "_" ) // символ отсутствия значения в conll
+      if ( sentence.atom(i, 2) == atom_none ) // символ отсутствия значения в conll
         continue;
-      auto& word = token[2];
-      auto it = vocab->find( word );
-      if (it == vocab->end())
-        (*vocab)[word] = 1;
-      else
-        ++it->second;
+      vocab.inc( sentence.atom(i, 2) );
     }
   } // method-end
-  void process_sentence_lemmas_proper(VocabMappingPtr vocab, const SentenceMatrix& sentence)
+  void process_sentence_lemmas_proper(AtomCounts& vocab, const SentenceMatrix& sentence)
   {
-    for (auto& token : sentence)
+    for (size_t i = 0; i < sentence.size(); ++i)
     {
-      if (token[7] == "PUNC")  // знаки препинания в словарь собственных имен не включаем
+      if (sentence.atom(i, 7) == atom_punc)  // знаки препинания в словарь собственных имен не включаем
         continue;
-      if ( !isProperName(token[5]) )
+      if ( !isProperName(sentence[i][5]) )
         continue;
-      if ( token[2] == "_" ) // символ отсутствия значения в conll
+      if ( sentence.atom(i, 2) == atom_none ) // символ отсутствия значения в conll
         continue;
-      auto& word = token[2];
-      auto it = vocab->find( word );
-      if (it == vocab->end())
-        (*vocab)[word] = 1;
-      else
-        ++it->second;
+      vocab.inc( sentence.atom(i, 2) );
     }
   } // method-end
-  void process_sentence_tokens(VocabMappingPtr vocab, Token2LemmasMapPtr token2lemmas_map, const SentenceMatrix& sentence)
+  void process_sentence_tokens(AtomCounts& vocab, AtomToken2LemmasMap& token2lemmas_map, const SentenceMatrix& sentence)
   {
-    for ( auto& token : sentence )
+    for (size_t i = 0; i < sentence.size(); ++i)
     {
-      if (token[7] == "PUNC")  // знаки препинания в словарь не включаем (они обрабатываются особо)
+      if (sentence.atom(i, 7) == atom_punc)  // знаки препинания в словарь не включаем (они обрабатываются особо)
         continue;
-      if ( token[1] == "_" || token[2] == "_" )   // символ отсутствия значения в conll
+      uint32_t word = sentence.atom(i, 1);
+      uint32_t lemma = sentence.atom(i, 2);
+      if ( word == atom_none || lemma == atom_none )   // символ отсутствия значения в conll
         continue;
-      auto word = token[1];
-
-      auto it = vocab->find( word );
-      if (it == vocab->end())
-        (*vocab)[word] = 1;
-      else
-        ++it->second;
-
-      auto itt = (*token2lemmas_map)[word].find( token[2] );
-      if ( itt == (*token2lemmas_map)[word].end() )
-        (*token2lemmas_map)[word][token[2]] = 1;
-      else
-        ++itt->second;
+      vocab.inc(word);
+      ++token2lemmas_map[word][lemma];
     }
   } // method-end
-  void process_sentence_dep_ctx(VocabMappingPtr vocab, const SentenceMatrix& sentence, size_t column, bool use_deprel)
+  void process_sentence_dep_ctx(DepCtxCounts& vocab_deprel, AtomCounts& vocab, const SentenceMatrix& sentence, size_t column, bool use_deprel)
   {
-    for (auto& token : sentence)
+    for (size_t i = 0; i < sentence.size(); ++i)
     {
+      uint32_t deprel = sentence.atom(i, 7);
       if ( use_deprel )
       {
-        if ( token[7] == "PUNC" )  // знаки препинания в словарь синтаксических контекстов не включаем
+        if ( deprel == atom_punc )  // знаки препинания в словарь синтаксических контекстов не включаем
           continue;
-        if ( token[column] == "_" || token[7] == "_" )  // символ отсутствия значения в conll
+        uint32_t word = sentence.atom(i, column);
+        if ( word == atom_none || deprel == atom_none )  // символ отсутствия значения в conll
           continue;
-        size_t parent_token_no = 0;
-        try {
-          parent_token_no = std::stoi(token[6]);
-        } catch (...) {
-          parent_token_no = 0; // если конвертирование неудачно, считаем, что нет родителя
-        }
-        if ( parent_token_no == 0 )
+        int head = sentence.head(i);
+        size_t parent_token_no = (head == ConllSentence::INVALID_NUMBER) ? 0 : head;  // если значение некорректно, считаем, что нет родителя
+        if ( parent_token_no == 0 || parent_token_no > sentence.size() )
           continue;
-        auto& parent = sentence[ parent_token_no - 1 ];
-        if ( parent[7] == "PUNC" ) // "контексты -- знаки препинания" нам не интересны
-          continue;                // note: не посчитаем контекст вниз, но его и не нужно, т.к. это контекст знака пунктуации
-        if ( parent[column] == "_" ) // символ отсутствия значения в conll
+        if ( sentence.atom(parent_token_no - 1, 7) == atom_punc ) // "контексты -- знаки препинания" нам не интересны
+          continue;                                               // note: не посчитаем контекст вниз, но его и не нужно, т.к. это контекст знака пунктуации
+        uint32_t parent_word = sentence.atom(parent_token_no - 1, column);
+        if ( parent_word == atom_none ) // символ отсутствия значения в conll
           continue;
 
-        // рассматриваем контекст с точки зрения родителя в синтаксической связи
-        auto ctx__from_head_viewpoint = token[column] + "<" + token[7];
-        auto it_h = vocab->find( ctx__from_head_viewpoint );
-        if (it_h == vocab->end())
-          (*vocab)[ctx__from_head_viewpoint] = 1;
-        else
-          ++it_h->second;
-        // рассматриваем контекст с точки зрения потомка в синтаксической связи
-        auto ctx__from_child_viewpoint = parent[column] + ">" + token[7];
-        auto it_c = vocab->find( ctx__from_child_viewpoint );
-        if (it_c == vocab->end())
-          (*vocab)[ctx__from_child_viewpoint] = 1;
-        else
-          ++it_c->second;
+        // рассматриваем контекст с точки зрения родителя в синтаксической связи (word<deprel)
+        ++vocab_deprel[ dep_ctx_key(word, deprel, false) ];
+        // рассматриваем контекст с точки зрения потомка в синтаксической связи (parent_word>deprel)
+        ++vocab_deprel[ dep_ctx_key(parent_word, deprel, true) ];
       }
       else
       {
-        if ( token[7] == "PUNC" )   // знаки препинания в словарь синтаксических контекстов не включаем
+        if ( deprel == atom_punc )   // знаки препинания в словарь синтаксических контекстов не включаем
           continue;
-        if ( token[column] == "_" ) // символ отсутствия значения в conll
+        uint32_t word = sentence.atom(i, column);
+        if ( word == atom_none ) // символ отсутствия значения в conll
           continue;
-        auto& word = token[column];
-        auto it = vocab->find( word );
-        if (it == vocab->end())
-          (*vocab)[word] = 1;
-        else
-          ++it->second;
+        vocab.inc(word);
       } // if ( use_depre ) then ... else ...
     }
   } // method-end
-  bool is_punct__patch(const std::string& word)
+  // составной ключ синтаксического контекста
+  static inline uint64_t dep_ctx_key(uint32_t word, uint32_t deprel, bool fromChild)
   {
-    const std::set<std::string> puncts = { ".", ",", "!", "?", ":", ";", "…", "...", "--", "—", "–", "‒",
-                                           "'", "ʼ", "ˮ", "\"", "«", "»", "“", "”", "„", "‟", "‘", "’", "‚", "‛",
-                                           "(", ")", "[", "]", "{", "}", "⟨", "⟩" };
-    if ( puncts.find(word) != puncts.end() )
-      return true;
-    else
-      return false;
-  }
+    return (static_cast<uint64_t>(word) << 32) | (static_cast<uint64_t>(deprel) << 1) | (fromChild ? 1 : 0);
+  } // method-end
+  // преобразование счётчика синтаксических контекстов в строковое отображение (lemma<deprel, lemma>deprel)
+  VocabMappingPtr dep_ctx_to_mapping(const DepCtxCounts& counts)
+  {
+    auto& atom_table = AtomTable::global();
+    VocabMappingPtr result = std::make_shared<VocabMapping>();
+    for (auto& r : counts)
+    {
+      uint32_t word = r.first >> 32;
+      uint32_t deprel = (r.first & 0xFFFFFFFF) >> 1;
+      bool fromChild = r.first & 1;
+      (*result)[ atom_table.str(word) + (fromChild ? ">" : "<") + atom_table.str(deprel) ] = r.second;
+    }
+    return result;
+  } // method-end
+  // преобразование мэппинга из токенов в леммы в строковое отображение
+  Token2LemmasMapPtr token2lemmas_to_mapping(const AtomToken2LemmasMap& t2l)
+  {
+    auto& atom_table = AtomTable::global();
+    Token2LemmasMapPtr result = std::make_shared<Token2LemmasMap>();
+    for (auto& t : t2l)
+    {
+      auto& lemmas = (*result)[ atom_table.str(t.first) ];
+      for (auto& l : t.second)
+        lemmas[ atom_table.str(l.first) ] = l.second;
+    }
+    return result;
+  } // method-end
+  static const std::set<std::string>& puncts()
+  {
+    static const std::set<std::string> PUNCTS = { ".", ",", "!", "?", ":", ";", "…", "...", "--", "—", "–", "‒",
+                                                  "'", "ʼ", "ˮ", "\"", "«", "»", "“", "”", "„", "‟", "‘", "’", "‚", "‛",
+                                                  "(", ")", "[", "]", "{", "}", "⟨", "⟩" };
+    return PUNCTS;
+  } // method-end
   // редукция и сохранение словаря в файл
   void save_vocab(VocabMappingPtr vocab, size_t min_count, const std::string& file_name, Token2LemmasMapPtr t2l = nullptr, const std::string& tlm_fn = std::string())
   {
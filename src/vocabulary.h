@@ -9,6 +9,7 @@
 #include <list>
 #include <iostream>
 #include <cmath>
+#include <cstdint>
 
 
 // данные словаря
@@ -68,13 +69,22 @@ public:
       return;
     auto total = cn_sum();
     float wc_mul_sample = total * sample;
-    for (auto& r : vocabulary)
+    sample_thresholds.resize(vocabulary.size());
+    for (size_t i = 0; i < vocabulary.size(); ++i)
     {
+      auto& r = vocabulary[i];
       float t_to_f = wc_mul_sample / r.cn;
       float prob = t_to_f + std::sqrt(t_to_f);          // согласно статье должно быть float prob = std::sqrt(t_to_f);
       r.sample_probability = (prob > 1) ? 1.0 : prob;
+      // слово сохраняется, если 16-битная случайная величина k удовлетворяет условию k/65536 <= p, т.е. k < floor(p*65536)+1
+      sample_thresholds[i] = static_cast<uint32_t>(r.sample_probability * 65536) + 1;
     }
   }
+  // получение целочисленного порога сэмплирования (для 16-битных случайных величин) по индексу
+  inline uint32_t idx_to_sample_threshold(size_t word_idx) const
+  {
+    return sample_thresholds[word_idx];
+  }
   // добавление записи в словарь
   virtual void append(const std::string& word, uint64_t cn)
   {
@@ -94,6 +104,8 @@ public:
   }
 protected:
   std::vector<VocabularyData> vocabulary;
+  // целочисленные пороги сэмплирования (плотный массив, чтобы при сабсэмплинге не обращаться к записям словаря)
+  std::vector<uint32_t> sample_thresholds;
 };
 
 